@@ -0,0 +1,106 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#include "helper.h"
+#include "arena.h"
+
+// Transparent huge pages are mapped on boundaries of their size
+#define HUGE_PAGE_SIZE (2UL << 20)
+
+struct arena arena = { .base = NULL, .size = 0, .used = 0 };
+
+//
+static inline uint64_t round_up(const uint64_t size, const uint64_t align)
+{
+  return (size + align - 1) / align * align;
+}
+
+void init_arena(const uint64_t size, const uint64_t huge_pages)
+{
+  // Reserved only, pages are committed as they are touched
+  const uint64_t length = round_up(size, HUGE_PAGE_SIZE) + HUGE_PAGE_SIZE;
+
+  char *base = mmap(NULL, length, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+  if (base == MAP_FAILED)
+    {
+      printf("Warning: cannot map an arena of %ld bytes, state is allocated "
+             "piece by piece\n", length);
+      return;
+    }
+
+  // Keep the huge page aligned part only
+  char *aligned = (char *)round_up((uint64_t)base, HUGE_PAGE_SIZE);
+
+  if (aligned > base)
+    munmap(base, aligned - base);
+
+  munmap(aligned + round_up(size, HUGE_PAGE_SIZE),
+         base + length - (aligned + round_up(size, HUGE_PAGE_SIZE)));
+
+  arena.base = aligned;
+  arena.size = round_up(size, HUGE_PAGE_SIZE);
+  arena.used = 0;
+  arena.peak = 0;
+  arena.huge_pages = huge_pages && madvise(arena.base, arena.size, MADV_HUGEPAGE) == 0;
+  arena.n_fallback = 0;
+}
+
+void *arena_alloc(const uint64_t size)
+{
+  const uint64_t bytes = round_up(size ? size : 1, ALIGN);
+
+  if (arena.base && arena.used + bytes <= arena.size)
+    {
+      void *ptr = arena.base + arena.used;
+
+      arena.used += bytes;
+      arena.peak = arena.used > arena.peak ? arena.used : arena.peak;
+
+      return ptr;
+    }
+
+  arena.n_fallback += arena.base != NULL;
+
+  return aligned_alloc(ALIGN, bytes);
+}
+
+void arena_free(void *ptr)
+{
+  const char *c = ptr;
+
+  if (arena.base && c >= arena.base && c < arena.base + arena.size)
+    return;
+
+  free(ptr);
+}
+
+uint64_t arena_mark(void)
+{
+  return arena.used;
+}
+
+void arena_release(const uint64_t mark)
+{
+  arena.used = mark;
+}
+
+void print_arena(void)
+{
+  if (!arena.base)
+    return;
+
+  printf("Arena: %.1lf MiB used of %.1lf MiB%s, %ld allocations outside\n",
+         arena.peak / (double)(1 << 20), arena.size / (double)(1 << 20),
+         arena.huge_pages ? " with huge pages" : "", arena.n_fallback);
+}
+
+void free_arena(void)
+{
+  if (arena.base)
+    munmap(arena.base, arena.size);
+
+  arena.base = NULL;
+}
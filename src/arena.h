@@ -0,0 +1,51 @@
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+// Arena of the running simulation
+extern struct arena arena;
+
+/**
+ * init_arena - Map size bytes, committed as they are touched
+ * @param size      : bytes of the mapping
+ * @param huge_pages: back the mapping with transparent huge pages
+ */
+void init_arena(const uint64_t size, const uint64_t huge_pages);
+
+/**
+ * arena_alloc - Aligned memory from the arena, or from aligned_alloc when
+ *               the arena is not mapped or full
+ * @param size: bytes
+ * @return memory aligned on ALIGN
+ */
+void *arena_alloc(const uint64_t size);
+
+/**
+ * arena_free - Release memory from arena_alloc. Memory of the arena is only
+ *              released by arena_release
+ * @param ptr: memory
+ */
+void arena_free(void *ptr);
+
+/**
+ * arena_mark - Bytes of the arena in use, to release what comes next
+ * @return mark
+ */
+uint64_t arena_mark(void);
+
+/**
+ * arena_release - Release every allocation made after mark, at once
+ * @param mark: bytes in use when arena_mark was called
+ */
+void arena_release(const uint64_t mark);
+
+/**
+ * print_arena - Print the peak of bytes in use and the fallbacks
+ */
+void print_arena(void);
+
+/**
+ * free_arena - Unmap the arena
+ */
+void free_arena(void);
+
+#endif // _ARENA_H_
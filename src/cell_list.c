@@ -0,0 +1,107 @@
+#include <stdlib.h>
+#include <math.h>
+
+#include "helper.h"
+#include "common.h"
+#include "arena.h"
+#include "cell_list.h"
+
+// Wrap x inside [0, L[
+static inline double wrap(const double x)
+{
+  return x - L * floor(x / L);
+}
+
+// Cell coordinate of a wrapped position
+static inline uint64_t cell_coordinate(const struct cell_list *restrict cl,
+                                       const double x)
+{
+  const uint64_t c = (uint64_t)(x / cl->side);
+
+  // Rounding can put x == L in an extra cell
+  return c < cl->n_cells ? c : cl->n_cells - 1;
+}
+
+struct cell_list *init_cell_list(const double r_cut)
+{
+  // Cells must be at least r_cut wide, and 3 per dimension so that the 27
+  // neighbouring cells are all distinct
+  const uint64_t n_cells = (uint64_t)(L / r_cut);
+
+  if (n_cells < 3)
+    return NULL;
+
+  // Allocate memory
+  struct cell_list *restrict cl = arena_alloc(sizeof(struct cell_list));
+
+  cl->n_cells = n_cells;
+  cl->side = L / (double)n_cells;
+
+  cl->cell_start =
+    arena_alloc(sizeof(uint64_t) * (cube(n_cells) + 1));
+  cl->index = arena_alloc(sizeof(uint64_t) * N_PARTICLES_LOCAL);
+  cl->w = init_particles(N_PARTICLES_LOCAL);
+
+  return cl;
+}
+
+void free_cell_list(struct cell_list *restrict cl)
+{
+  arena_free(cl->cell_start);
+  arena_free(cl->index);
+  free_particles(cl->w);
+  arena_free(cl);
+}
+
+uint64_t cell_id(const struct cell_list *restrict cl,
+                 const int64_t cx, const int64_t cy, const int64_t cz)
+{
+  return ((uint64_t)cx * cl->n_cells + (uint64_t)cy) * cl->n_cells + (uint64_t)cz;
+}
+
+void build_cell_list(struct cell_list *restrict cl,
+                     const struct particle *restrict p)
+{
+  const uint64_t n = cube(cl->n_cells);
+
+  // Count particles per cell, shifted by one to get the prefix sum in place
+  for (uint64_t c = 0; c < n + 1; c++)
+    cl->cell_start[c] = 0;
+
+  for (uint64_t i = 0; i < N_PARTICLES_LOCAL; i++)
+    {
+      const uint64_t c = cell_id(cl,
+                                 cell_coordinate(cl, wrap(p->x[i])),
+                                 cell_coordinate(cl, wrap(p->y[i])),
+                                 cell_coordinate(cl, wrap(p->z[i])));
+      cl->cell_start[c + 1]++;
+    }
+
+  for (uint64_t c = 0; c < n; c++)
+    cl->cell_start[c + 1] += cl->cell_start[c];
+
+  // Scatter particles, the first slot of each cell is used as cursor
+  for (uint64_t i = 0; i < N_PARTICLES_LOCAL; i++)
+    {
+      const double wx = wrap(p->x[i]);
+      const double wy = wrap(p->y[i]);
+      const double wz = wrap(p->z[i]);
+
+      const uint64_t c = cell_id(cl,
+                                 cell_coordinate(cl, wx),
+                                 cell_coordinate(cl, wy),
+                                 cell_coordinate(cl, wz));
+      const uint64_t k = cl->cell_start[c]++;
+
+      cl->index[k] = i;
+      cl->w->x[k] = wx;
+      cl->w->y[k] = wy;
+      cl->w->z[k] = wz;
+    }
+
+  // Restore the start of each cell
+  for (uint64_t c = n; c > 0; c--)
+    cl->cell_start[c] = cl->cell_start[c - 1];
+
+  cl->cell_start[0] = 0;
+}
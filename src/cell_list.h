@@ -0,0 +1,18 @@
+#ifndef _CELL_LIST_H_
+#define _CELL_LIST_H_
+
+// Return NULL when the box holds less than 3 cells of side r_cut per dimension
+struct cell_list *init_cell_list(const double r_cut);
+
+//
+void free_cell_list(struct cell_list *restrict cl);
+
+// Bin the particles, wrapped inside the box, by cell
+void build_cell_list(struct cell_list *restrict cl,
+                     const struct particle *restrict p);
+
+//
+uint64_t cell_id(const struct cell_list *restrict cl,
+                 const int64_t cx, const int64_t cy, const int64_t cz);
+
+#endif // _CELL_LIST_H_
@@ -0,0 +1,300 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "helper.h"
+#include "common.h"
+#include "neighbour_list.h"
+#include "io.h"
+#include "arena.h"
+#include "checkpoint.h"
+
+// Checkpoint: the header, then the x, y, z, px, py, pz, fx, fy and fz arrays
+// of N_PARTICLES_TOTAL doubles, the index in the input file of each particle,
+// then the reference positions of the neighbour list when it was built
+#define CHECKPOINT_MAGIC   "ISMCKPT"
+#define CHECKPOINT_VERSION 5
+
+struct checkpoint_header
+{
+  char magic[8];
+  uint64_t version;
+  uint64_t n_particles;
+  uint64_t step;
+  uint64_t seed;
+  uint64_t n_threads;
+  uint64_t trajectory_offset;
+  uint64_t trajectory_format;
+  double trajectory_resolution;
+  double thermostat;
+  double energy;
+  struct force sum;
+
+  // Neighbour list statistics, the list is rebuilt from its reference
+  // positions when n_build is not 0
+  uint64_t n_build;
+  uint64_t n_update;
+  uint64_t n_pairs;
+};
+
+// Names of the trajectory formats, as given with --format=
+static const char *const format_name[] = { "pdb", "bin", "compressed" };
+
+//
+static void write_block(const int fd, const void *restrict data,
+                        const uint64_t size, const char *filename)
+{
+  const char *restrict c = data;
+
+  for (uint64_t done = 0; done < size;)
+    {
+      const ssize_t n = write(fd, c + done, size - done);
+
+      if (n <= 0)
+        {
+          printf("Error when write the file %s\n", filename);
+          exit(ERR_OPEN);
+        }
+
+      done += n;
+    }
+}
+
+//
+static void read_block(const int fd, void *restrict data,
+                       const uint64_t size, const char *filename)
+{
+  char *restrict c = data;
+
+  for (uint64_t done = 0; done < size;)
+    {
+      const ssize_t n = read(fd, c + done, size - done);
+
+      if (n <= 0)
+        {
+          printf("Error: %s is truncated\n", filename);
+          exit(ERR_OPEN);
+        }
+
+      done += n;
+    }
+}
+
+void write_checkpoint(const char *filename, const uint64_t step,
+                      const double thermostat,
+                      const struct particle *restrict p,
+                      const struct kinetic_moment *restrict km,
+                      const struct lennard_jones *restrict plj,
+                      const uint64_t *restrict id,
+                      struct trajectory *restrict traj)
+{
+  const struct neighbour_list *restrict nl = plj->nl;
+  const uint64_t size = sizeof(double) * N_PARTICLES_TOTAL;
+
+  struct checkpoint_header header =
+    {
+      .magic = CHECKPOINT_MAGIC,
+      .version = CHECKPOINT_VERSION,
+      .n_particles = N_PARTICLES_TOTAL,
+      .step = step,
+      .seed = SEED,
+      .n_threads = plj->n_threads,
+      .trajectory_offset = traj ? flush_trajectory(traj) : 0,
+      .trajectory_format = traj ? traj->format : FORMAT_PDB,
+      .trajectory_resolution = traj ? traj->resolution : 0.0,
+      .thermostat = thermostat,
+      .energy = plj->energy,
+      .sum = *plj->sum,
+      .n_build = nl ? nl->n_build : 0,
+      .n_update = nl ? nl->n_update : 0,
+      .n_pairs = nl ? nl->n_pairs : 0
+    };
+
+  // Written aside, the previous checkpoint stays valid until the rename
+  char tmp[512];
+  snprintf(tmp, sizeof(tmp), "%s.tmp", filename);
+
+  const int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+  if (fd < 0)
+    {
+      printf("Error when open the file %s\n", tmp);
+      exit(ERR_OPEN);
+    }
+
+  write_block(fd, &header, sizeof(struct checkpoint_header), tmp);
+
+  write_block(fd, p->x, size, tmp);
+  write_block(fd, p->y, size, tmp);
+  write_block(fd, p->z, size, tmp);
+
+  write_block(fd, km->px, size, tmp);
+  write_block(fd, km->py, size, tmp);
+  write_block(fd, km->pz, size, tmp);
+
+  write_block(fd, plj->sum_i->fx, size, tmp);
+  write_block(fd, plj->sum_i->fy, size, tmp);
+  write_block(fd, plj->sum_i->fz, size, tmp);
+
+  // Particles in the order of the input file without id
+  if (id)
+    write_block(fd, id, sizeof(uint64_t) * N_PARTICLES_TOTAL, tmp);
+  else
+    {
+      const uint64_t mark = arena_mark();
+      uint64_t *restrict in_order = arena_alloc(sizeof(uint64_t) * N_PARTICLES_TOTAL);
+
+      for (uint64_t i = 0; i < N_PARTICLES_TOTAL; i++)
+        in_order[i] = i;
+
+      write_block(fd, in_order, sizeof(uint64_t) * N_PARTICLES_TOTAL, tmp);
+
+      arena_free(in_order);
+      arena_release(mark);
+    }
+
+  if (header.n_build)
+    {
+      write_block(fd, nl->p0->x, size, tmp);
+      write_block(fd, nl->p0->y, size, tmp);
+      write_block(fd, nl->p0->z, size, tmp);
+    }
+
+  fsync(fd);
+  close(fd);
+
+  if (rename(tmp, filename) != 0)
+    {
+      printf("Error when rename the file %s\n", tmp);
+      exit(ERR_OPEN);
+    }
+}
+
+uint64_t read_checkpoint(const char *filename, double *restrict thermostat,
+                         struct particle *restrict p,
+                         struct kinetic_moment *restrict km,
+                         struct lennard_jones *restrict plj,
+                         uint64_t *restrict id,
+                         const uint64_t format,
+                         const double resolution,
+                         uint64_t *restrict offset)
+{
+  struct neighbour_list *restrict nl = plj->nl;
+  const uint64_t size = sizeof(double) * N_PARTICLES_TOTAL;
+
+  const int fd = open(filename, O_RDONLY);
+
+  if (fd < 0)
+    {
+      printf("Error when open the file %s\n", filename);
+      exit(ERR_OPEN);
+    }
+
+  // Header
+  struct checkpoint_header header;
+
+  read_block(fd, &header, sizeof(struct checkpoint_header), filename);
+
+  if (memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic)) != 0 ||
+      header.version != CHECKPOINT_VERSION ||
+      header.n_particles != N_PARTICLES_TOTAL ||
+      header.trajectory_format > FORMAT_COMPRESSED)
+    {
+      printf("Error: %s is not a checkpoint of %ld particles\n",
+             filename, N_PARTICLES_TOTAL);
+      exit(ERR_OPEN);
+    }
+
+  // Frames are appended to the trajectory of the checkpoint, in its format
+  if (header.trajectory_format != format)
+    {
+      printf("Error: %s was written with --format=%s, restart with the same "
+             "format\n", filename, format_name[header.trajectory_format]);
+      exit(ERR_USAGE);
+    }
+
+  // Compressed frames are decoded with the resolution of the file header
+  if (format == FORMAT_COMPRESSED &&
+      header.trajectory_resolution != resolution)
+    {
+      printf("Error: %s was written with --resolution=%g, restart with the "
+             "same resolution\n", filename, header.trajectory_resolution);
+      exit(ERR_USAGE);
+    }
+
+  // Forces are summed by thread, in another order with another count
+  if (header.n_threads != plj->n_threads)
+    printf("Warning: checkpoint written with %ld threads, the run will not "
+           "continue bit for bit\n", header.n_threads);
+
+  SEED = header.seed;
+  *thermostat = header.thermostat;
+  *offset = header.trajectory_offset;
+
+  read_block(fd, p->x, size, filename);
+  read_block(fd, p->y, size, filename);
+  read_block(fd, p->z, size, filename);
+
+  read_block(fd, km->px, size, filename);
+  read_block(fd, km->py, size, filename);
+  read_block(fd, km->pz, size, filename);
+
+  read_block(fd, plj->sum_i->fx, size, filename);
+  read_block(fd, plj->sum_i->fy, size, filename);
+  read_block(fd, plj->sum_i->fz, size, filename);
+
+  // Particles are kept in the order of the input file without id
+  if (id)
+    read_block(fd, id, sizeof(uint64_t) * N_PARTICLES_TOTAL, filename);
+  else
+    {
+      const uint64_t mark = arena_mark();
+      uint64_t *restrict order = arena_alloc(sizeof(uint64_t) * N_PARTICLES_TOTAL);
+
+      read_block(fd, order, sizeof(uint64_t) * N_PARTICLES_TOTAL, filename);
+
+      for (uint64_t i = 0; i < N_PARTICLES_TOTAL; i++)
+        if (order[i] != i)
+          {
+            printf("Error: %s holds reordered particles\n", filename);
+            exit(ERR_OPEN);
+          }
+
+      arena_free(order);
+      arena_release(mark);
+    }
+
+  plj->energy = header.energy;
+  *plj->sum = header.sum;
+
+  // Same list as the one in use when the checkpoint was written
+  if (header.n_build)
+    {
+      // Scratch, given back to the arena once the list is built
+      const uint64_t mark = arena_mark();
+      struct particle *restrict p0 = init_particles(N_PARTICLES_TOTAL);
+
+      read_block(fd, p0->x, size, filename);
+      read_block(fd, p0->y, size, filename);
+      read_block(fd, p0->z, size, filename);
+
+      if (nl)
+        restart_neighbour_list(nl, p0);
+
+      free_particles(p0);
+      arena_release(mark);
+    }
+
+  if (nl)
+    {
+      nl->n_build = header.n_build;
+      nl->n_update = header.n_update;
+      nl->n_pairs = header.n_pairs;
+    }
+
+  close(fd);
+
+  return header.step;
+}
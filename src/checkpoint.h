@@ -0,0 +1,50 @@
+#ifndef _CHECKPOINT_H_
+#define _CHECKPOINT_H_
+
+/**
+ * write_checkpoint - Store the state of the run after step in file nammed
+ *                    filename, through a temporary file renamed once complete
+ * @param filename  : file name
+ * @param step      : last step done
+ * @param thermostat: thermostat to apply with the next step
+ * @param p         : positions of particles
+ * @param km        : kinetic moments
+ * @param plj       : forces of the last step, and neighbour list
+ * @param id        : index in the input file of each particle, NULL when in
+ *                    order
+ * @param traj      : trajectory, flushed so that its size matches step
+ */
+void write_checkpoint(const char *filename, const uint64_t step,
+                      const double thermostat,
+                      const struct particle *restrict p,
+                      const struct kinetic_moment *restrict km,
+                      const struct lennard_jones *restrict plj,
+                      const uint64_t *restrict id,
+                      struct trajectory *restrict traj);
+
+/**
+ * read_checkpoint - Restore the state of the run from file nammed filename
+ * @param filename  : file name
+ * @param thermostat: filled with thermostat to apply with the next step
+ * @param p         : filled with positions of particles
+ * @param km        : filled with kinetic moments
+ * @param plj       : filled with forces of the last step, and neighbour list
+ * @param id        : filled with index in the input file of each particle,
+ *                    NULL when the particles must be in order
+ * @param format    : format of the trajectory to append to, the one of the
+ *                    checkpoint
+ * @param resolution: quantization step of compressed positions, the one of
+ *                    the checkpoint
+ * @param offset    : filled with size of the trajectory at the last step
+ * @return last step done
+ */
+uint64_t read_checkpoint(const char *filename, double *restrict thermostat,
+                         struct particle *restrict p,
+                         struct kinetic_moment *restrict km,
+                         struct lennard_jones *restrict plj,
+                         uint64_t *restrict id,
+                         const uint64_t format,
+                         const double resolution,
+                         uint64_t *restrict offset);
+
+#endif // _CHECKPOINT_H_
@@ -1,84 +1,283 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <omp.h>
 
 #include "helper.h"
 #include "common.h"
+#include "arena.h"
 
-struct particle *get_particles(const char *restrict filename)
+struct particle *init_particles(const uint64_t n)
 {
-  // Begin exploration of the file
-  FILE *restrict stream = fopen(filename, "r");
+  // Allocate memory
+  struct particle *restrict p = arena_alloc(sizeof(struct particle));
+
+  p->x = arena_alloc(sizeof(double) * n);
+  p->y = arena_alloc(sizeof(double) * n);
+  p->z = arena_alloc(sizeof(double) * n);
+
+  return p;
+}
 
-  if (!stream)
+void copy_particles(struct particle *restrict dst,
+                    const struct particle *restrict src, const uint64_t n)
+{
+  for (uint64_t i = 0; i < n; i++)
     {
-      printf("Error when open the file %s\n", filename);
-      exit(ERR_OPEN);
+      dst->x[i] = src->x[i];
+      dst->y[i] = src->y[i];
+      dst->z[i] = src->z[i];
     }
+}
 
-  // Count number of line
-  uint64_t count = 0;
+// Powers of ten exactly representable as double
+static const double exact_pow10[] =
+  {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+  };
 
-  // Skip data
-  uint64_t first   = 0;
-  uint64_t second  = 0;
-  uint64_t useless = 0;
-  double one       = 0.0;
-  double two       = 0.0;
-  double three     = 0.0;
+// Skip blanks, without crossing end
+static inline const char *skip_blanks(const char *restrict s,
+                                      const char *restrict end)
+{
+  while (s < end && (*s == ' ' || *s == '\t' || *s == '\r'))
+    s++;
 
-  // Skip the comment line
-  fscanf(stream, "%lu %lu\n", &first, &second);
+  return s;
+}
+
+// Parse the decimal number at *s and move *s after it. Correctly rounded
+// when the digits fit in a double and the power of ten is exact, which
+// covers fixed point coordinates, else left to strtod
+static double parse_double(const char *restrict *s, const char *restrict end)
+{
+  const char *restrict c = *s;
+
+  // Sign
+  const uint64_t negative = c < end && *c == '-';
+
+  if (c < end && (*c == '-' || *c == '+'))
+    c++;
+
+  // Digits, the decimal point moves the exponent
+  uint64_t mantissa = 0;
+  uint64_t digits = 0;
+  int64_t exponent = 0;
+
+  for (; c < end && *c >= '0' && *c <= '9'; c++, digits++)
+    mantissa = 10 * mantissa + (uint64_t)(*c - '0');
+
+  if (c < end && *c == '.')
+    for (c++; c < end && *c >= '0' && *c <= '9'; c++, digits++, exponent--)
+      mantissa = 10 * mantissa + (uint64_t)(*c - '0');
+
+  // Exponent
+  if (c < end && (*c == 'e' || *c == 'E'))
+    {
+      c++;
+
+      const int64_t sign = c < end && *c == '-' ? -1 : 1;
+      int64_t e = 0;
+
+      if (c < end && (*c == '-' || *c == '+'))
+        c++;
 
-  while (fscanf(stream, "%lu %lf %lf %lf\n", &useless, &one, &two, &three) != EOF)
+      for (; c < end && *c >= '0' && *c <= '9'; c++)
+        e = 10 * e + (*c - '0');
+
+      exponent += sign * e;
+    }
+
+  if (digits <= 19 && mantissa < (1ULL << 53) && exponent >= -22 && exponent <= 22)
     {
-      count++;
+      *s = c;
+
+      const double value = exponent < 0 ?
+        (double)mantissa / exact_pow10[-exponent] :
+        (double)mantissa * exact_pow10[exponent];
+
+      return negative ? -value : value;
     }
 
-  // Set the number of particles
-  N_PARTICLES_TOTAL = count;
+  // The file is not null terminated, strtod works on a copy
+  char number[64] = "";
+  const uint64_t length = (uint64_t)(c - *s) < sizeof(number) - 1 ?
+    (uint64_t)(c - *s) : sizeof(number) - 1;
 
-  if (LOCAL_EQUAL_TOTAL)
-    N_PARTICLES_LOCAL = N_PARTICLES_TOTAL;
+  memcpy(number, *s, length);
+  *s = c;
+
+  return strtod(number, NULL);
+}
 
-  // Close file to re-open it
-  fclose(stream);
+// Count the particles of the non blank lines between begin and end, and store
+// them from first when p is set
+static uint64_t visit_lines(const char *restrict begin, const char *restrict end,
+                            struct particle *restrict p, const uint64_t first)
+{
+  uint64_t n = 0;
 
-  // Init particles
-  struct particle *restrict p =
-    aligned_alloc(ALIGN, sizeof(struct particle) * N_PARTICLES_LOCAL);
+  for (const char *restrict s = begin; s < end;)
+    {
+      const char *restrict eol = memchr(s, '\n', end - s);
+
+      if (!eol)
+        eol = end;
+
+      s = skip_blanks(s, eol);
+
+      if (s != eol)
+        {
+          if (p)
+            {
+              // Skip the atom type
+              while (s < eol && *s != ' ' && *s != '\t')
+                s++;
+
+              s = skip_blanks(s, eol);
+              p->x[first + n] = parse_double(&s, eol);
+              s = skip_blanks(s, eol);
+              p->y[first + n] = parse_double(&s, eol);
+              s = skip_blanks(s, eol);
+              p->z[first + n] = parse_double(&s, eol);
+            }
+
+          n++;
+        }
 
-  // Begin exploration of the file
-  FILE *restrict f = fopen(filename, "r");
+      s = eol + 1;
+    }
+
+  return n;
+}
+
+struct particle *get_particles(const char *restrict filename)
+{
+  // Map the file
+  const int fd = open(filename, O_RDONLY);
+  struct stat st;
 
-  if (!f)
+  if (fd < 0 || fstat(fd, &st) < 0)
     {
       printf("Error when open the file %s\n", filename);
       exit(ERR_OPEN);
     }
 
+  const uint64_t size = st.st_size;
+  const char *restrict data = size ?
+    mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0) : NULL;
+
+  if (data == MAP_FAILED)
+    {
+      printf("Error when map the file %s\n", filename);
+      exit(ERR_OPEN);
+    }
+
+  close(fd);
+
+  if (size)
+    madvise((void *)data, size, MADV_WILLNEED);
+
   // Skip the comment line
-  fscanf(f, "%lu %lu\n", &first, &second);
+  const char *restrict end = data + size;
+  const char *restrict begin = size ? memchr(data, '\n', size) : NULL;
 
-  for (uint64_t i = 0; i < N_PARTICLES_LOCAL; i++)
+  begin = begin ? begin + 1 : end;
+
+  // One chunk of whole lines per thread
+  const uint64_t n_chunks = omp_get_max_threads();
+  const char **restrict start = malloc(sizeof(const char *) * (n_chunks + 1));
+  uint64_t *restrict count = malloc(sizeof(uint64_t) * (n_chunks + 1));
+
+  start[0] = begin;
+  start[n_chunks] = end;
+
+  for (uint64_t k = 1; k < n_chunks; k++)
     {
-      fscanf(f, "%lu %lf %lf %lf\n", &useless, &(p[i].x), &(p[i].y), &(p[i].z));
+      const char *restrict c = begin + (end - begin) * k / n_chunks;
+
+      if (c < start[k - 1])
+        c = start[k - 1];
+
+      while (c < end && c > begin && c[-1] != '\n')
+        c++;
+
+      start[k] = c;
     }
 
-  fclose(f);
+  // Count the particles of each chunk
+#pragma omp parallel for schedule(static, 1)
+  for (uint64_t k = 0; k < n_chunks; k++)
+    count[k + 1] = visit_lines(start[k], start[k + 1], NULL, 0);
+
+  // Index of the first particle of each chunk
+  count[0] = 0;
+
+  for (uint64_t k = 0; k < n_chunks; k++)
+    count[k + 1] += count[k];
+
+  // Set the number of particles
+  N_PARTICLES_TOTAL = count[n_chunks];
+
+  if (LOCAL_EQUAL_TOTAL)
+    N_PARTICLES_LOCAL = N_PARTICLES_TOTAL;
+
+  // Init particles
+  struct particle *restrict p = init_particles(N_PARTICLES_LOCAL);
+
+  // Parse, each thread writing its own particles
+#pragma omp parallel for schedule(static, 1)
+  for (uint64_t k = 0; k < n_chunks; k++)
+    visit_lines(start[k], start[k + 1], p, count[k]);
+
+  // Release memory
+  free(start);
+  free(count);
+
+  if (size)
+    munmap((void *)data, size);
 
   return p;
 }
 
 void free_particles(struct particle *restrict p)
 {
-  free(p);
+  arena_free(p->x);
+  arena_free(p->y);
+  arena_free(p->z);
+  arena_free(p);
+}
+
+struct forces *init_forces(const uint64_t n)
+{
+  // Allocate memory
+  struct forces *restrict f = arena_alloc(sizeof(struct forces));
+
+  f->fx = arena_alloc(sizeof(double) * n);
+  f->fy = arena_alloc(sizeof(double) * n);
+  f->fz = arena_alloc(sizeof(double) * n);
+
+  return f;
+}
+
+void free_forces(struct forces *restrict f)
+{
+  arena_free(f->fx);
+  arena_free(f->fy);
+  arena_free(f->fz);
+  arena_free(f);
 }
 
 void print_particles(const struct particle *restrict p)
 {
   for (uint64_t i = 0; i < N_PARTICLES_LOCAL; i++)
     {
-      printf("%13e %13e %13e\n", p[i].x, p[i].y, p[i].z);
+      printf("%13e %13e %13e\n", p->x[i], p->y[i], p->z[i]);
     }
 }
 
@@ -87,17 +286,7 @@ void print_energy(const struct lennard_jones *restrict lj)
   printf("energy: %lf\n", lj->energy);
 }
 
-double compute_square_distance_3D(const struct particle *restrict a,
-                                  const struct particle *restrict b)
-{
-  const double x_2 = square(a->x - b->x);
-  const double y_2 = square(a->y - b->y);
-  const double z_2 = square(a->z - b->z);
-
-  return x_2 + y_2 + z_2;
-}
-
-uint64_t check_forces(const struct force **restrict f,
+uint64_t check_forces(const struct lennard_jones *restrict lj,
                       const double tolerance)
 {
   uint64_t error = 0;
@@ -109,6 +298,7 @@ uint64_t check_forces(const struct force **restrict f,
       .fz = 0.0
     };
 
+#if FORCE_MATRIX
   for (uint64_t i = 0; i < N_PARTICLES_LOCAL; i++)
     {
       // Init sum of forces on particle i
@@ -122,9 +312,9 @@ uint64_t check_forces(const struct force **restrict f,
       // Sum on particle i
       for (uint64_t j = 0; j < N_PARTICLES_LOCAL; j++)
         {
-          sum_i.fx += f[i][j].fx;
-          sum_i.fy += f[i][j].fy;
-          sum_i.fz += f[i][j].fz;
+          sum_i.fx += lj->f[i][j].fx;
+          sum_i.fy += lj->f[i][j].fy;
+          sum_i.fz += lj->f[i][j].fz;
         }
 
       // Update global sum
@@ -132,6 +322,15 @@ uint64_t check_forces(const struct force **restrict f,
       sum.fy += sum_i.fy;
       sum.fz += sum_i.fz;
     }
+#else
+  // Stream over the accumulated force of each particle
+  for (uint64_t i = 0; i < N_PARTICLES_LOCAL; i++)
+    {
+      sum.fx += lj->sum_i->fx[i];
+      sum.fy += lj->sum_i->fy[i];
+      sum.fz += lj->sum_i->fz[i];
+    }
+#endif
 
   // Get absolute value of sum to compare with a tolerance
   struct force abs_sum =
@@ -162,17 +361,34 @@ uint64_t check_forces(const struct force **restrict f,
   return error;
 }
 
+uint64_t n_translation_vectors(const double r_cut)
+{
+  // Shells of images to add around the minimum image, whose components are
+  // in [-L/2, L/2], to reach every image under r_cut
+  const uint64_t shells = (uint64_t)(r_cut / L + 0.5);
+
+  return cube(2 * shells + 1);
+}
+
 struct translation_vector *init_translation_vectors(const uint64_t n)
 {
   //
   struct translation_vector *restrict tv =
-    aligned_alloc(ALIGN, sizeof(struct translation_vector) * n);
+    arena_alloc(sizeof(struct translation_vector) * n);
+
+  // Number of images per dimension
+  int64_t m = 1;
+
+  while ((uint64_t)cube(m) < n)
+    m += 2;
+
+  const int64_t shells = m / 2;
 
   for (uint64_t i = 0; i < n; i++)
     {
-      tv[i].x = (double)((int64_t)(i / 9)       - (int64_t)1) * L;
-      tv[i].y = (double)((int64_t)((i / 3) % 3) - (int64_t)1) * L;
-      tv[i].z = (double)((int64_t)(i % 3)       - (int64_t)1) * L;
+      tv[i].x = (double)((int64_t)(i / (m * m))   - shells) * L;
+      tv[i].y = (double)((int64_t)((i / m) % m) - shells) * L;
+      tv[i].z = (double)((int64_t)(i % m)       - shells) * L;
     }
 
   return tv;
@@ -187,5 +403,5 @@ void print_translation_vectors(const struct translation_vector *restrict tv,
 
 void free_translation_vector(struct translation_vector *restrict tv)
 {
-  free(tv);
+  arena_free(tv);
 }
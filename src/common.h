@@ -2,18 +2,26 @@
 #define _COMMON_H_
 
 // Particles
+struct particle *init_particles(const uint64_t n);
+void copy_particles(struct particle *restrict dst,
+                    const struct particle *restrict src, const uint64_t n);
 struct particle *get_particles(const char *restrict filename);
 void free_particles(struct particle *restrict p);
+
+// Forces
+struct forces *init_forces(const uint64_t n);
+void free_forces(struct forces *restrict f);
+
+//
 void print_particles(const struct particle *restrict p);
 void print_energy(const struct lennard_jones *restrict lj);
 
 // Compute
-double compute_square_distance_3D(const struct particle *restrict a,
-                                  const struct particle *restrict b);
-uint64_t check_forces(const struct force **restrict f,
+uint64_t check_forces(const struct lennard_jones *restrict lj,
                       const double tolerance);
 
 // Translation vectors
+uint64_t n_translation_vectors(const double r_cut);
 struct translation_vector *init_translation_vectors(const uint64_t n);
 void print_translation_vectors(const struct translation_vector *restrict tv,
                                const uint64_t n);
@@ -0,0 +1,337 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "helper.h"
+#include "arena.h"
+#include "domain.h"
+
+#if MPI
+
+// Values sent per migrating particle: position, kinetic moment and id
+#define MIGRATE_SIZE 7
+
+// Values sent per ghost particle: position
+#define GHOST_SIZE 3
+
+// Values gathered per particle: id and position
+#define GATHER_SIZE 4
+
+// Wrap x inside [0, L[
+static inline double wrap(const double x)
+{
+  return x - L * floor(x / L);
+}
+
+// Coordinate along dimension d of the subdomain owning position x
+static inline int owner(const struct domain *restrict dd, const int d,
+                        const double x)
+{
+  const int k = (int)(wrap(x) / dd->width[d]);
+
+  // Rounding can put x == L in an extra subdomain
+  return k < dd->dims[d] ? k : dd->dims[d] - 1;
+}
+
+// Send n particles of size values to the neighbour dir along d, receive from
+// the opposite one, return the number of particles received
+static uint64_t shift(struct domain *restrict dd, const int d, const int dir,
+                      const double *restrict send, const uint64_t n,
+                      double *restrict recv, const uint64_t size)
+{
+  const int dest = dd->neighbour[d][dir];
+  const int source = dd->neighbour[d][1 - dir];
+  uint64_t n_recv = 0;
+
+  MPI_Sendrecv(&n, 1, MPI_UINT64_T, dest, 0,
+               &n_recv, 1, MPI_UINT64_T, source, 0,
+               dd->comm, MPI_STATUS_IGNORE);
+
+  MPI_Sendrecv(send, n * size, MPI_DOUBLE, dest, 1,
+               recv, n_recv * size, MPI_DOUBLE, source, 1,
+               dd->comm, MPI_STATUS_IGNORE);
+
+  return n_recv;
+}
+
+struct domain *init_domain(const double r_cut)
+{
+  // Allocate memory
+  struct domain *restrict dd = arena_alloc(sizeof(struct domain));
+
+  // Periodic grid of processes, as cubic as possible
+  int periods[3] = { 1, 1, 1 };
+
+  for (int d = 0; d < 3; d++)
+    dd->dims[d] = 0;
+
+  MPI_Comm_size(MPI_COMM_WORLD, &dd->n_ranks);
+  MPI_Dims_create(dd->n_ranks, 3, dd->dims);
+  MPI_Cart_create(MPI_COMM_WORLD, 3, dd->dims, periods, 0, &dd->comm);
+  MPI_Comm_rank(dd->comm, &dd->rank);
+  MPI_Cart_coords(dd->comm, dd->rank, 3, dd->coords);
+
+  dd->r_cut = r_cut;
+
+  for (int d = 0; d < 3; d++)
+    {
+      MPI_Cart_shift(dd->comm, d, 1, &dd->neighbour[d][0], &dd->neighbour[d][1]);
+
+      dd->width[d] = L / dd->dims[d];
+      dd->lo[d] = dd->coords[d] * dd->width[d];
+
+      // Ghosts come from the direct neighbours, and each of them once when
+      // both neighbours are the same process
+      const double min_width = dd->dims[d] == 2 ? 2.0 * r_cut : r_cut;
+
+      if (dd->dims[d] > 1 && dd->width[d] < min_width)
+        {
+          if (dd->rank == 0)
+            printf("Error: %d processes give subdomains of %lf for a cut-off of %lf\n",
+                   dd->n_ranks, dd->width[d], r_cut);
+
+          exit(ERR_DOMAIN);
+        }
+    }
+
+  dd->n_ghosts = 0;
+  dd->id = arena_alloc(sizeof(uint64_t) * N_PARTICLES_TOTAL);
+  dd->send[0] = arena_alloc(sizeof(double) * MIGRATE_SIZE * N_PARTICLES_TOTAL);
+  dd->send[1] = arena_alloc(sizeof(double) * MIGRATE_SIZE * N_PARTICLES_TOTAL);
+  dd->recv = arena_alloc(sizeof(double) * MIGRATE_SIZE * N_PARTICLES_TOTAL);
+  dd->counts = arena_alloc(sizeof(int) * dd->n_ranks);
+  dd->displs = arena_alloc(sizeof(int) * dd->n_ranks);
+
+  return dd;
+}
+
+void free_domain(struct domain *restrict dd)
+{
+  MPI_Comm_free(&dd->comm);
+
+  arena_free(dd->id);
+  arena_free(dd->send[0]);
+  arena_free(dd->send[1]);
+  arena_free(dd->recv);
+  arena_free(dd->counts);
+  arena_free(dd->displs);
+  arena_free(dd);
+}
+
+void scatter_particles(struct domain *restrict dd,
+                       struct particle *restrict p,
+                       struct kinetic_moment *restrict km)
+{
+  uint64_t n = 0;
+
+  for (uint64_t i = 0; i < N_PARTICLES_TOTAL; i++)
+    {
+      if (owner(dd, 0, p->x[i]) != dd->coords[0] ||
+          owner(dd, 1, p->y[i]) != dd->coords[1] ||
+          owner(dd, 2, p->z[i]) != dd->coords[2])
+        continue;
+
+      p->x[n] = p->x[i];
+      p->y[n] = p->y[i];
+      p->z[n] = p->z[i];
+
+      km->px[n] = km->px[i];
+      km->py[n] = km->py[i];
+      km->pz[n] = km->pz[i];
+
+      dd->id[n] = i;
+      n++;
+    }
+
+  N_PARTICLES_LOCAL = n;
+  LOCAL_EQUAL_TOTAL = dd->n_ranks == 1;
+  dd->n_ghosts = 0;
+}
+
+void migrate_particles(struct domain *restrict dd,
+                       struct particle *restrict p,
+                       struct kinetic_moment *restrict km)
+{
+  double *restrict r[3] = { p->x, p->y, p->z };
+  double *restrict m[3] = { km->px, km->py, km->pz };
+
+  // One dimension after the other, so that particles reach diagonal
+  // subdomains in several hops
+  for (int d = 0; d < 3; d++)
+    {
+      if (dd->dims[d] == 1)
+        continue;
+
+      uint64_t n_misplaced = 0;
+
+      do
+        {
+          uint64_t n_send[2] = { 0, 0 };
+
+          for (uint64_t i = 0; i < N_PARTICLES_LOCAL;)
+            {
+              const int k = owner(dd, d, r[d][i]);
+
+              if (k == dd->coords[d])
+                {
+                  i++;
+                  continue;
+                }
+
+              // Towards the nearest way, 1 for the upper neighbour
+              const int dir =
+                (k - dd->coords[d] + dd->dims[d]) % dd->dims[d] <= dd->dims[d] / 2;
+
+              double *restrict buffer = dd->send[dir] + MIGRATE_SIZE * n_send[dir]++;
+
+              buffer[0] = p->x[i];
+              buffer[1] = p->y[i];
+              buffer[2] = p->z[i];
+              buffer[3] = km->px[i];
+              buffer[4] = km->py[i];
+              buffer[5] = km->pz[i];
+              buffer[6] = (double)dd->id[i];
+
+              // Fill the hole with the last particle
+              const uint64_t last = --N_PARTICLES_LOCAL;
+
+              for (int c = 0; c < 3; c++)
+                {
+                  r[c][i] = r[c][last];
+                  m[c][i] = m[c][last];
+                }
+
+              dd->id[i] = dd->id[last];
+            }
+
+          for (int dir = 0; dir < 2; dir++)
+            {
+              const uint64_t n_recv =
+                shift(dd, d, dir, dd->send[dir], n_send[dir], dd->recv, MIGRATE_SIZE);
+
+              for (uint64_t g = 0; g < n_recv; g++)
+                {
+                  const double *restrict buffer = dd->recv + MIGRATE_SIZE * g;
+                  const uint64_t i = N_PARTICLES_LOCAL++;
+
+                  p->x[i] = buffer[0];
+                  p->y[i] = buffer[1];
+                  p->z[i] = buffer[2];
+                  km->px[i] = buffer[3];
+                  km->py[i] = buffer[4];
+                  km->pz[i] = buffer[5];
+                  dd->id[i] = (uint64_t)buffer[6];
+                }
+            }
+
+          // Particles that crossed more than one subdomain travel again
+          n_misplaced = 0;
+
+          for (uint64_t i = 0; i < N_PARTICLES_LOCAL; i++)
+            n_misplaced += owner(dd, d, r[d][i]) != dd->coords[d];
+
+          MPI_Allreduce(MPI_IN_PLACE, &n_misplaced, 1, MPI_UINT64_T, MPI_SUM,
+                        dd->comm);
+        }
+      while (n_misplaced);
+    }
+}
+
+void exchange_ghosts(struct domain *restrict dd, struct particle *restrict p)
+{
+  double *restrict r[3] = { p->x, p->y, p->z };
+
+  dd->n_ghosts = 0;
+
+  // One dimension after the other, forwarding the ghosts already received so
+  // that edges and corners reach diagonal subdomains
+  for (int d = 0; d < 3; d++)
+    {
+      if (dd->dims[d] == 1)
+        continue;
+
+      const uint64_t n = N_PARTICLES_LOCAL + dd->n_ghosts;
+      uint64_t n_send[2] = { 0, 0 };
+
+      for (uint64_t i = 0; i < n; i++)
+        {
+          // Position inside the subdomain along d
+          const double s = wrap(r[d][i]) - dd->lo[d];
+
+          for (int dir = 0; dir < 2; dir++)
+            {
+              if (dir ? s < dd->width[d] - dd->r_cut : s >= dd->r_cut)
+                continue;
+
+              double *restrict buffer = dd->send[dir] + GHOST_SIZE * n_send[dir]++;
+
+              buffer[0] = p->x[i];
+              buffer[1] = p->y[i];
+              buffer[2] = p->z[i];
+            }
+        }
+
+      for (int dir = 0; dir < 2; dir++)
+        {
+          const uint64_t n_recv =
+            shift(dd, d, dir, dd->send[dir], n_send[dir], dd->recv, GHOST_SIZE);
+
+          for (uint64_t g = 0; g < n_recv; g++)
+            {
+              const double *restrict buffer = dd->recv + GHOST_SIZE * g;
+              const uint64_t i = N_PARTICLES_LOCAL + dd->n_ghosts++;
+
+              p->x[i] = buffer[0];
+              p->y[i] = buffer[1];
+              p->z[i] = buffer[2];
+            }
+        }
+    }
+}
+
+void gather_particles(struct domain *restrict dd,
+                      const struct particle *restrict p,
+                      struct particle *restrict all)
+{
+  // Id and position of the local particles
+  for (uint64_t i = 0; i < N_PARTICLES_LOCAL; i++)
+    {
+      double *restrict buffer = dd->send[0] + GATHER_SIZE * i;
+
+      buffer[0] = (double)dd->id[i];
+      buffer[1] = p->x[i];
+      buffer[2] = p->y[i];
+      buffer[3] = p->z[i];
+    }
+
+  const int count = GATHER_SIZE * N_PARTICLES_LOCAL;
+
+  MPI_Gather(&count, 1, MPI_INT, dd->counts, 1, MPI_INT, 0, dd->comm);
+
+  if (dd->rank == 0)
+    {
+      dd->displs[0] = 0;
+
+      for (int r = 1; r < dd->n_ranks; r++)
+        dd->displs[r] = dd->displs[r - 1] + dd->counts[r - 1];
+    }
+
+  MPI_Gatherv(dd->send[0], count, MPI_DOUBLE,
+              dd->recv, dd->counts, dd->displs, MPI_DOUBLE, 0, dd->comm);
+
+  if (dd->rank != 0)
+    return;
+
+  // Back in input order
+  for (uint64_t g = 0; g < N_PARTICLES_TOTAL; g++)
+    {
+      const double *restrict buffer = dd->recv + GATHER_SIZE * g;
+      const uint64_t i = (uint64_t)buffer[0];
+
+      all->x[i] = buffer[1];
+      all->y[i] = buffer[2];
+      all->z[i] = buffer[3];
+    }
+}
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef _DOMAIN_H_
+#define _DOMAIN_H_
+
+#if MPI
+
+// One subdomain per process, on a periodic grid. Exit when a subdomain is
+// too narrow for the ghosts at r_cut to come from its direct neighbours only
+struct domain *init_domain(const double r_cut);
+
+//
+void free_domain(struct domain *restrict dd);
+
+// Keep the particles of the subdomain, out of every particle of the box
+void scatter_particles(struct domain *restrict dd,
+                       struct particle *restrict p,
+                       struct kinetic_moment *restrict km);
+
+// Hand the particles that left the subdomain to their new owner
+void migrate_particles(struct domain *restrict dd,
+                       struct particle *restrict p,
+                       struct kinetic_moment *restrict km);
+
+// Copy after the local particles the particles of the other subdomains
+// closer than r_cut to the subdomain
+void exchange_ghosts(struct domain *restrict dd, struct particle *restrict p);
+
+// Gather every particle in input order on the first process
+void gather_particles(struct domain *restrict dd,
+                      const struct particle *restrict p,
+                      struct particle *restrict all);
+
+#endif
+
+#endif // _DOMAIN_H_
@@ -0,0 +1,122 @@
+#include <stdlib.h>
+#include <math.h>
+#include <omp.h>
+
+#include "helper.h"
+#include "common.h"
+#include "arena.h"
+#include "force_engine.h"
+#include "velocity_verlet.h"
+#include "ensemble.h"
+
+struct ensemble *init_ensemble(const struct particle *restrict p0,
+                               const uint64_t n_replicas,
+                               const struct force_engine *engine,
+                               const double r_cut, const double skin)
+{
+  // Allocate memory
+  struct ensemble *restrict e = arena_alloc(sizeof(struct ensemble));
+
+  e->n_replicas = n_replicas;
+  e->n_threads = omp_get_max_threads();
+  e->max_active_levels = omp_get_max_active_levels();
+  e->r = arena_alloc(sizeof(struct replica) * n_replicas);
+  e->tv = init_translation_vectors(n_translation_vectors(r_cut));
+
+  // A replica runs on one thread, its force buffers are for one thread only,
+  // and the parallel regions of its step do not start teams of their own
+  // until the ensemble is released
+  omp_set_max_active_levels(1);
+  omp_set_num_threads(1);
+
+  for (uint64_t k = 0; k < n_replicas; k++)
+    {
+      struct replica *restrict r = &e->r[k];
+
+      r->p = init_particles(N_PARTICLES_TOTAL);
+      copy_particles(r->p, p0, N_PARTICLES_TOTAL);
+
+      r->km = init_replica_velocity_verlet(k);
+      r->plj = init_force_engine(engine, r_cut, skin);
+      r->ket = init_ket();
+      r->thermostat = 0.0;
+    }
+
+  omp_set_num_threads(e->n_threads);
+
+  return e;
+}
+
+void free_ensemble(struct ensemble *restrict e)
+{
+  for (uint64_t k = 0; k < e->n_replicas; k++)
+    {
+      struct replica *restrict r = &e->r[k];
+
+      free_particles(r->p);
+      free_kinetic_moment(r->km);
+      r->plj->engine->free(r->plj);
+      free_ket(r->ket);
+    }
+
+  omp_set_max_active_levels(e->max_active_levels);
+
+  free_translation_vector(e->tv);
+  arena_free(e->r);
+  arena_free(e);
+}
+
+void ensemble_forces(struct ensemble *restrict e, const double r_cut)
+{
+#pragma omp parallel for schedule(dynamic, 1) num_threads(e->n_threads)
+  for (uint64_t k = 0; k < e->n_replicas; k++)
+    {
+      struct replica *restrict r = &e->r[k];
+
+      compute_forces(r->p, e->tv, r->plj, r_cut);
+      compute_kinetic_energy_and_temperature(r->ket, r->km);
+    }
+}
+
+void ensemble_step(struct ensemble *restrict e, const double r_cut,
+                   const uint64_t thermostat)
+{
+  // Parallel regions of the step run on the thread of the replica
+#pragma omp parallel for schedule(dynamic, 1) num_threads(e->n_threads)
+  for (uint64_t k = 0; k < e->n_replicas; k++)
+    {
+      struct replica *restrict r = &e->r[k];
+
+      velocity_verlet(r->p, e->tv, r->plj, r->km, r->ket, r_cut, r->thermostat);
+
+      // Applied with the first kick of the next step
+      r->thermostat = thermostat ? berendsen_thermostat(r->ket) : 0.0;
+    }
+}
+
+void ensemble_mean(const struct ensemble *restrict e,
+                   struct ket *restrict mean,
+                   double *restrict energy,
+                   double *restrict std_energy)
+{
+  double kinetic_energy = 0.0;
+  double temperature = 0.0;
+  double sum = 0.0;
+  double sum_2 = 0.0;
+
+  for (uint64_t k = 0; k < e->n_replicas; k++)
+    {
+      const struct replica *restrict r = &e->r[k];
+      const double total = r->ket->kinetic_energy + r->plj->energy;
+
+      kinetic_energy += r->ket->kinetic_energy;
+      temperature += r->ket->temperature;
+      sum += total;
+      sum_2 += square(total);
+    }
+
+  mean->kinetic_energy = kinetic_energy / e->n_replicas;
+  mean->temperature = temperature / e->n_replicas;
+  *energy = sum / e->n_replicas;
+  *std_energy = sqrt(fmax(sum_2 / e->n_replicas - square(*energy), 0.0));
+}
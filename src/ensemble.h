@@ -0,0 +1,55 @@
+#ifndef _ENSEMBLE_H_
+#define _ENSEMBLE_H_
+
+/**
+ * init_ensemble - Replicas starting from the same positions, with kinetic
+ *                 moments drawn from a stream of their own
+ * @param p0        : positions of particles
+ * @param n_replicas: number of replicas
+ * @param engine    : force engine of every replica
+ * @param r_cut     : cutoff distance
+ * @param skin      : neighbour list skin
+ * @return ensemble
+ */
+struct ensemble *init_ensemble(const struct particle *restrict p0,
+                               const uint64_t n_replicas,
+                               const struct force_engine *engine,
+                               const double r_cut, const double skin);
+
+/**
+ * free_ensemble - Release memory
+ * @param e: ensemble
+ */
+void free_ensemble(struct ensemble *restrict e);
+
+/**
+ * ensemble_forces - Forces, kinetic energy and temperature of every replica,
+ *                   before the first step
+ * @param e    : ensemble
+ * @param r_cut: cutoff distance
+ */
+void ensemble_forces(struct ensemble *restrict e, const double r_cut);
+
+/**
+ * ensemble_step - One velocity verlet step of every replica, spread over
+ *                 the threads
+ * @param e         : ensemble
+ * @param r_cut     : cutoff distance
+ * @param thermostat: apply the thermostat of each replica with the next step
+ */
+void ensemble_step(struct ensemble *restrict e, const double r_cut,
+                   const uint64_t thermostat);
+
+/**
+ * ensemble_mean - Mean and standard deviation over the replicas
+ * @param e         : ensemble
+ * @param mean      : filled with mean kinetic energy and temperature
+ * @param energy    : filled with mean total energy
+ * @param std_energy: filled with standard deviation of total energy
+ */
+void ensemble_mean(const struct ensemble *restrict e,
+                   struct ket *restrict mean,
+                   double *restrict energy,
+                   double *restrict std_energy);
+
+#endif // _ENSEMBLE_H_
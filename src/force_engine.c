@@ -0,0 +1,107 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "helper.h"
+#include "common.h"
+#include "lennard_jones.h"
+#include "force_engine.h"
+
+#if !MPI
+//
+static struct lennard_jones *init_all_pairs(__attribute__ ((unused)) const double r_cut,
+                                            __attribute__ ((unused)) const double skin)
+{
+  return init_lennard_jones();
+}
+
+//
+static void compute_all_pairs(struct lennard_jones *restrict lj,
+                              struct particle *restrict p,
+                              __attribute__ ((unused)) const struct translation_vector *restrict tv,
+                              __attribute__ ((unused)) const double r_cut)
+{
+  lennard_jones(lj, p);
+}
+#endif
+
+#if MPI
+//
+static struct lennard_jones *init_periodic(const double r_cut,
+                                           __attribute__ ((unused)) const double skin)
+{
+  return init_domain_lennard_jones(r_cut);
+}
+
+// Over the subdomains
+static void compute_periodic(struct lennard_jones *restrict lj,
+                             struct particle *restrict p,
+                             __attribute__ ((unused)) const struct translation_vector *restrict tv,
+                             const double r_cut)
+{
+  domain_lennard_jones(lj, p, r_cut);
+}
+#else
+//
+static struct lennard_jones *init_periodic(const double r_cut, const double skin)
+{
+  return init_periodical_lennard_jones(r_cut, skin);
+}
+
+//
+static void compute_periodic(struct lennard_jones *restrict lj,
+                             struct particle *restrict p,
+                             const struct translation_vector *restrict tv,
+                             const double r_cut)
+{
+  periodical_lennard_jones(lj, p, tv, r_cut, n_translation_vectors(r_cut));
+}
+#endif
+
+// Engines, the all pairs engine only sees the particles of a process
+static const struct force_engine force_engines[] =
+  {
+    {
+      .name = "periodic",
+      .init = init_periodic,
+      .compute = compute_periodic,
+      .free = free_lennard_jones,
+      .periodic = 1
+    },
+#if !MPI
+    {
+      .name = "all-pairs",
+      .init = init_all_pairs,
+      .compute = compute_all_pairs,
+      .free = free_lennard_jones,
+      .periodic = 0
+    },
+#endif
+  };
+
+#define N_FORCE_ENGINES (sizeof(force_engines) / sizeof(struct force_engine))
+
+const struct force_engine *find_force_engine(const char *name)
+{
+  for (uint64_t e = 0; e < N_FORCE_ENGINES; e++)
+    if (strcmp(force_engines[e].name, name) == 0)
+      return &force_engines[e];
+
+  return NULL;
+}
+
+void print_force_engines(void)
+{
+  for (uint64_t e = 0; e < N_FORCE_ENGINES; e++)
+    printf("%s%s", e ? ", " : "", force_engines[e].name);
+
+  printf("\n");
+}
+
+struct lennard_jones *init_force_engine(const struct force_engine *engine,
+                                        const double r_cut, const double skin)
+{
+  struct lennard_jones *restrict lj = engine->init(r_cut, skin);
+  lj->engine = engine;
+
+  return lj;
+}
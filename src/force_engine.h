@@ -0,0 +1,26 @@
+#ifndef _FORCE_ENGINE_H_
+#define _FORCE_ENGINE_H_
+
+/**
+ * find_force_engine - Look for an engine by name
+ * @param name: name of the engine
+ * @return the engine, NULL when no engine is nammed name
+ */
+const struct force_engine *find_force_engine(const char *name);
+
+/**
+ * print_force_engines - Print the names of the engines, comma separated
+ */
+void print_force_engines(void);
+
+/**
+ * init_force_engine - Allocate the forces of engine
+ * @param engine: force engine
+ * @param r_cut : cut-off radius
+ * @param skin  : neighbour list skin, 0 without neighbour list
+ * @return forces, computed by engine
+ */
+struct lennard_jones *init_force_engine(const struct force_engine *engine,
+                                        const double r_cut, const double skin);
+
+#endif // _FORCE_ENGINE_H_
@@ -1,13 +1,21 @@
 #ifndef _HELPER_H_
 #define _HELPER_H_
 
+#include <stdio.h>
 #include <stdint.h>
+#include <pthread.h>
+
+#if MPI
+#include <mpi.h>
+
+#if FORCE_MATRIX
+#error "FORCE_MATRIX holds local particles only, it does not support MPI"
+#endif
+#endif
 
 // Simulation constants
 #define R_STAR              3.0
 #define EPSILON_STAR        0.2
-#define L                   50.0
-#define N_SYM               27
 #define TOLERANCE           1.0e-7
 #define DT                  1.0
 #define FORCE_CONVERSION    4.186e-4
@@ -41,30 +49,47 @@
 #define hexa(x)   ((x) * (x) * (x) * (x) * (x) * (x))
 #define septa(x)  ((x) * (x) * (x) * (x) * (x) * (x) * (x))
 
+// Periodic maths macros, need math.h
+#define minimum_image(x) ((x) - L * nearbyint((x) / L))
+
 // Global variable
+extern double L;
 extern uint64_t N_PARTICLES_TOTAL;
 extern uint64_t N_PARTICLES_LOCAL;
 extern uint64_t LOCAL_EQUAL_TOTAL;
 extern uint64_t N_DL;
 extern double R_CUT;
+extern double SKIN;
+extern uint64_t N_THREADS;
+extern uint64_t RANK;
+extern uint64_t SEED;
+extern uint64_t PRECISION;
 
 // Handle errors
 enum
   {
     ERR_NONE,
     ERR_USAGE,
-    ERR_OPEN
+    ERR_OPEN,
+    ERR_DOMAIN
   };
 
-// Particles
+// Precision of the pair kernels
+enum
+  {
+    PRECISION_DOUBLE,
+    PRECISION_MIXED
+  };
+
+// Particles, stored as structure of arrays
 struct particle
 {
-  double x;
-  double y;
-  double z;
+  double *restrict x;
+  double *restrict y;
+  double *restrict z;
 };
 
-// Forces
+// Force
 struct force
 {
   double fx;
@@ -72,28 +97,147 @@ struct force
   double fz;
 };
 
+// Forces on every particle, stored as structure of arrays
+struct forces
+{
+  double *restrict fx;
+  double *restrict fy;
+  double *restrict fz;
+};
+
+struct translation_vector
+{
+  double x;
+  double y;
+  double z;
+};
+
+// Pair interactions between particle i and n particles j. j is seen from i
+// through the minimum image when wrap is set, then translated by tv
+struct pair_row
+{
+  double xi;
+  double yi;
+  double zi;
+  const double *restrict x;
+  const double *restrict y;
+  const double *restrict z;
+  double *restrict fx;
+  double *restrict fy;
+  double *restrict fz;
+  uint64_t n;
+  uint64_t wrap;
+  struct translation_vector tv;
+  double r_cut_2;
+#if FORCE_MATRIX
+  // Index of i, and of the j, either j + k or index[k]
+  uint64_t i;
+  uint64_t j;
+  const uint64_t *restrict index;
+  struct force **restrict f;
+#endif
+};
+
+// Add the interactions of a row to f_i and energy, and remove them from the
+// forces on the particles j
+typedef void (*pair_kernel)(const struct pair_row *restrict row,
+                            struct force *restrict f_i,
+                            double *restrict energy);
+
+// Cell list
+struct cell_list
+{
+  uint64_t n_cells;
+  double side;
+  uint64_t *restrict cell_start;
+  uint64_t *restrict index;
+  struct particle *restrict w;
+};
+
+// Neighbour list
+struct neighbour_list
+{
+  double r_cut;
+  double skin;
+  uint64_t capacity;
+  uint64_t *restrict start;
+  uint32_t *restrict j;
+  int8_t *restrict image;
+  struct particle *restrict p0;
+  struct cell_list *restrict cl;
+
+  // Statistics
+  uint64_t n_build;
+  uint64_t n_update;
+  uint64_t n_pairs;
+};
+
+#if MPI
+// Spatial domain decomposition, one subdomain per process on a periodic grid.
+// Particles are stored local first, then ghosts
+struct domain
+{
+  MPI_Comm comm;
+  int rank;
+  int n_ranks;
+  int dims[3];
+  int coords[3];
+  int neighbour[3][2];
+  double width[3];
+  double lo[3];
+  double r_cut;
+  uint64_t n_ghosts;
+  uint64_t *restrict id;
+  double *restrict send[2];
+  double *restrict recv;
+  int *restrict counts;
+  int *restrict displs;
+};
+#endif
+
 // Lennard jones
 struct lennard_jones
 {
   double energy;
+#if FORCE_MATRIX
   struct force **restrict f;
-  struct force *restrict sum_i;
+#endif
+  struct forces *restrict sum_i;
   struct force *restrict sum;
+  uint64_t n_threads;
+  struct forces **restrict sum_t;
+  struct cell_list *restrict cl;
+  struct neighbour_list *restrict nl;
+#if MPI
+  struct domain *restrict dd;
+#endif
+  pair_kernel kernel;
+  uint64_t precision;
+  const struct force_engine *engine;
 };
 
-struct translation_vector
+// Force engine, selected at runtime by name. init allocates the forces
+// computed by compute, released by free
+struct force_engine
 {
-  double x;
-  double y;
-  double z;
+  const char *name;
+  struct lennard_jones *(*init)(const double r_cut, const double skin);
+  void (*compute)(struct lennard_jones *restrict lj,
+                  struct particle *restrict p,
+                  const struct translation_vector *restrict tv,
+                  const double r_cut);
+  void (*free)(struct lennard_jones *restrict lj);
+
+  // Only the pairs closer than r_cut interact, through the periodic boundaries
+  uint64_t periodic;
 };
 
-// Velocity verlet
+// Velocity verlet, kinetic moments stored as structure of arrays
 struct kinetic_moment
 {
-  double px;
-  double py;
-  double pz;
+  double *restrict px;
+  double *restrict py;
+  double *restrict pz;
 };
 
 struct ket
@@ -102,4 +246,145 @@ struct ket
   double temperature;
 };
 
+// Trajectory, written through a file kept open for the whole run by a writer
+// thread draining a ring of frames
+struct trajectory
+{
+  FILE *restrict f;
+  char *restrict buffer;
+  uint64_t format;
+  float *restrict frame;
+
+  // Compressed format: positions in quanta of resolution, of the last frame,
+  // and the frame being packed
+  double resolution;
+  uint64_t n_frames;
+  int32_t *restrict q;
+  uint32_t *restrict v;
+  uint8_t *restrict packed;
+
+  // Ring of frames, from head to tail
+  pthread_t writer;
+  pthread_mutex_t lock;
+  pthread_cond_t not_empty;
+  pthread_cond_t not_full;
+  uint64_t head;
+  uint64_t tail;
+  uint64_t done;
+  uint64_t *restrict ite;
+  struct particle *restrict slot;
+};
+
+// Independent run of an ensemble, from the positions shared by every replica
+// and kinetic moments of its own
+struct replica
+{
+  struct particle *restrict p;
+  struct kinetic_moment *restrict km;
+  struct lennard_jones *restrict plj;
+  struct ket *restrict ket;
+  double thermostat;
+};
+
+// Replicas advanced together, each one by a single thread of the team
+struct ensemble
+{
+  uint64_t n_replicas;
+  uint64_t n_threads;
+  uint64_t max_active_levels;
+  struct replica *restrict r;
+  struct translation_vector *restrict tv;
+};
+
+// Order of the particles in memory, along a Morton curve once sorted. id
+// gives the index in the input file of each particle
+struct reorder
+{
+  uint64_t *restrict id;
+  uint64_t *restrict order;
+  uint64_t *restrict tmp;
+  uint32_t *restrict key;
+  uint32_t *restrict key_tmp;
+  double *restrict scratch;
+  uint64_t n_sort;
+};
+
+// Phases of a step, timed when built with TIMERS
+enum
+  {
+    TIMER_FORCES,
+    TIMER_INTEGRATION,
+    TIMER_KINETIC_ENERGY,
+    TIMER_THERMOSTAT,
+    TIMER_IO,
+    TIMER_REORDER,
+    N_TIMERS
+  };
+
+// Time spent in each phase, during the current step and for every step
+struct timers
+{
+  double wall;
+  double start[N_TIMERS];
+  double current[N_TIMERS];
+  uint64_t n_steps;
+  uint64_t step;
+  double *restrict samples[N_TIMERS];
+};
+
+// Hardware events counted with --perf-counters
+enum
+  {
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_LLC_MISSES,
+    PERF_FP_SCALAR,
+    PERF_FP_128,
+    PERF_FP_256,
+    PERF_FP_512,
+    N_PERF_EVENTS
+  };
+
+// Regions of code the events are counted in
+enum
+  {
+    PERF_LENNARD_JONES,
+    PERF_PERIODICAL_LENNARD_JONES,
+    PERF_FORCES,
+    PERF_INTEGRATION,
+    N_PERF_REGIONS
+  };
+
+// Counter of an event, with the times it was enabled and running, to scale
+// it when the events are multiplexed
+struct perf_count
+{
+  uint64_t value;
+  uint64_t enabled;
+  uint64_t running;
+};
+
+// Events of the process and of the threads it creates, -1 for the events
+// the processor does not count
+struct perf_counters
+{
+  uint64_t enabled;
+  int fd[N_PERF_EVENTS];
+  struct perf_count start[N_PERF_EVENTS];
+  double count[N_PERF_REGIONS][N_PERF_EVENTS];
+  uint64_t calls[N_PERF_REGIONS];
+};
+
+// Memory of the state of the runs, carved from one mapping. Allocations
+// beyond its size fall back to aligned_alloc
+struct arena
+{
+  char *base;
+  uint64_t size;
+  uint64_t used;
+  uint64_t peak;
+  uint64_t huge_pages;
+  uint64_t n_fallback;
+};
+
 #endif // _HELPER_H_
@@ -1,30 +1,81 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
+#include <unistd.h>
 
 #include "helper.h"
 #include "io.h"
 
-void reset_file(const char *filename)
+// Buffer of the trajectory file, frames are written by large blocks
+#define TRAJECTORY_BUFFER (1 << 22)
+
+// Frames waiting for the writer thread before store_particles blocks
+#define TRAJECTORY_SLOTS 4
+
+// Binary trajectory: the header once, then for each frame the iteration
+// number followed by the x, y and z blocks of N_PARTICLES_TOTAL floats
+#define TRAJECTORY_MAGIC   "ISMTRAJ"
+#define TRAJECTORY_VERSION 1
+
+struct trajectory_header
 {
-  FILE *restrict f = fopen(filename, "w");
+  char magic[8];
+  uint64_t version;
+  uint64_t n_particles;
+  double box[3];
+};
 
-  if (!f)
-    {
-      printf("Error when open the file %s\n", filename);
-      exit(ERR_OPEN);
-    }
+// Compressed trajectory: the header once, then for each frame its header
+// followed by the x, y and z positions in quanta of resolution, packed by
+// blocks. A key frame holds the positions minus their minimum, the origin,
+// the other frames the difference with the previous frame
+#define COMPRESSED_MAGIC   "ISMCTRJ"
+#define COMPRESSED_VERSION 1
+
+// Frames between two key frames, a file is appended from a key frame
+#define COMPRESSED_KEYFRAME 100
+
+// Values of a block, written as their number of bits on one byte followed by
+// the values on that number of bits, 4 bytes per bit
+#define PACK_BLOCK 32
 
-  fclose(f);
+struct compressed_header
+{
+  char magic[8];
+  uint64_t version;
+  uint64_t n_particles;
+  double box[3];
+  double resolution;
+};
+
+struct compressed_frame
+{
+  uint64_t ite;
+  uint32_t keyframe;
+  uint32_t size;
+  int32_t origin[3];
+  int32_t unused;
+};
 
-  return;
+// Values of the blocks of a frame, N_PARTICLES_TOTAL padded to PACK_BLOCK
+static inline uint64_t padded_particles(void)
+{
+  return (N_PARTICLES_TOTAL + PACK_BLOCK - 1) / PACK_BLOCK * PACK_BLOCK;
+}
+
+// Bytes of the largest frame, every block on 32 bits
+static inline uint64_t packed_size(void)
+{
+  return 3 * (padded_particles() / PACK_BLOCK) * (1 + sizeof(uint32_t) * 32);
 }
 
-void store_particles(const char *filename, const struct particle *restrict p,
-                     const uint64_t ite)
+//
+static struct trajectory *init_trajectory(const char *filename,
+                                          const char *mode,
+                                          const uint64_t format)
 {
-  // Begin exploration of the file
-  FILE *restrict f = fopen(filename, "a");
+  FILE *restrict f = fopen(filename, mode);
 
   if (!f)
     {
@@ -32,25 +83,548 @@ void store_particles(const char *filename, const struct particle *restrict p,
       exit(ERR_OPEN);
     }
 
-  fseek(f, 0, SEEK_END);
+  // Allocate memory
+  struct trajectory *restrict t = aligned_alloc(ALIGN, sizeof(struct trajectory));
+
+  t->f = f;
+  t->format = format;
+  t->buffer = malloc(TRAJECTORY_BUFFER);
+  t->frame = NULL;
+  t->ite = NULL;
+  t->slot = NULL;
+  t->resolution = 0.0;
+  t->n_frames = 0;
+  t->q = NULL;
+  t->v = NULL;
+  t->packed = NULL;
+
+  setvbuf(t->f, t->buffer, _IOFBF, TRAJECTORY_BUFFER);
 
+  return t;
+}
+
+//
+static void store_pdb(FILE *restrict f, const struct particle *restrict p,
+                      const uint64_t ite)
+{
   // Print first lines
   fprintf(f, "CRYST1  %.2lf  %.2lf  %.2lf  90.00  90.00  90.00  P  1\n", L, L, L);
   fprintf(f, "MODEL  %ld\n", ite);
 
   // Print positions
-  for (uint64_t i = 0; i < N_PARTICLES_LOCAL; i++)
+  for (uint64_t i = 0; i < N_PARTICLES_TOTAL; i++)
     {
       fprintf(f, "ATOM  %5ld  C   0  %10.3lf  %10.3lf  %10.3lf  MRES\n",
-              i + 1, p[i].x, p[i].y, p[i].z);
+              i + 1, p->x[i], p->y[i], p->z[i]);
     }
 
   // Print last lines
   fprintf(f, "TER\n");
   fprintf(f, "ENDMDL\n");
+}
+
+//
+static void store_bin(struct trajectory *restrict t,
+                      const struct particle *restrict p, const uint64_t ite)
+{
+  const uint64_t n = N_PARTICLES_TOTAL;
+
+  float *restrict x = t->frame;
+  float *restrict y = t->frame + n;
+  float *restrict z = t->frame + 2 * n;
+
+  for (uint64_t i = 0; i < n; i++)
+    {
+      x[i] = (float)p->x[i];
+      y[i] = (float)p->y[i];
+      z[i] = (float)p->z[i];
+    }
+
+  fwrite(&ite, sizeof(uint64_t), 1, t->f);
+  fwrite(t->frame, sizeof(float), 3 * n, t->f);
+}
+
+// Nearest quantum of x
+static inline int32_t quantize(const double x, const double scale)
+{
+  const double s = x * scale;
+
+  if (s > INT32_MAX / 2 || s < -INT32_MAX / 2)
+    {
+      printf("Error: position %lf out of the range of the compressed "
+             "trajectory, increase --resolution=\n", x);
+      exit(ERR_USAGE);
+    }
+
+  return (int32_t)(s < 0.0 ? s - 0.5 : s + 0.5);
+}
+
+// Signed difference as unsigned, small in absolute value as small
+static inline uint32_t zigzag(const int32_t d)
+{
+  return ((uint32_t)d << 1) ^ (uint32_t)(d >> 31);
+}
+
+static inline int32_t unzigzag(const uint32_t v)
+{
+  return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+// Pack PACK_BLOCK values, return the number of bytes written
+static uint64_t pack_block(const uint32_t *restrict v, uint8_t *restrict out)
+{
+  uint32_t m = 0;
+
+  for (uint64_t k = 0; k < PACK_BLOCK; k++)
+    m |= v[k];
+
+  const uint32_t bits = m ? 32 - __builtin_clz(m) : 0;
+  uint8_t *restrict o = out + 1;
+  uint64_t acc = 0;
+  uint32_t n_bits = 0;
+
+  out[0] = (uint8_t)bits;
+
+  // PACK_BLOCK values of bits bits fill bits words of 32 bits
+  for (uint64_t k = 0; k < PACK_BLOCK; k++)
+    {
+      acc |= (uint64_t)v[k] << n_bits;
+      n_bits += bits;
+
+      if (n_bits >= 32)
+        {
+          const uint32_t word = (uint32_t)acc;
+          memcpy(o, &word, sizeof(uint32_t));
+
+          o += sizeof(uint32_t);
+          acc >>= 32;
+          n_bits -= 32;
+        }
+    }
+
+  return 1 + sizeof(uint32_t) * bits;
+}
+
+// Unpack PACK_BLOCK values, return the number of bytes read
+static uint64_t unpack_block(const uint8_t *restrict in, uint32_t *restrict v)
+{
+  const uint32_t bits = in[0];
+  const uint64_t mask = bits == 32 ? UINT32_MAX : ((uint64_t)1 << bits) - 1;
+  const uint8_t *restrict i = in + 1;
+  uint64_t acc = 0;
+  uint32_t n_bits = 0;
+
+  for (uint64_t k = 0; k < PACK_BLOCK; k++)
+    {
+      if (n_bits < bits)
+        {
+          uint32_t word;
+          memcpy(&word, i, sizeof(uint32_t));
+
+          acc |= (uint64_t)word << n_bits;
+          i += sizeof(uint32_t);
+          n_bits += 32;
+        }
+
+      v[k] = (uint32_t)(acc & mask);
+      acc >>= bits;
+      n_bits -= bits;
+    }
+
+  return 1 + sizeof(uint32_t) * bits;
+}
+
+//
+static void store_compressed(struct trajectory *restrict t,
+                             const struct particle *restrict p,
+                             const uint64_t ite)
+{
+  const uint64_t n = N_PARTICLES_TOTAL;
+  const double scale = 1.0 / t->resolution;
+  const double *restrict c[3] = { p->x, p->y, p->z };
+
+  struct compressed_frame frame =
+    {
+      .ite = ite,
+      .keyframe = t->n_frames % COMPRESSED_KEYFRAME == 0,
+      .origin = { 0, 0, 0 },
+      .unused = 0
+    };
+
+  uint32_t *restrict v = t->v;
+  uint8_t *restrict out = t->packed;
+
+  for (uint64_t d = 0; d < 3; d++)
+    {
+      int32_t *restrict q = t->q + d * n;
+
+      if (frame.keyframe)
+        {
+          int32_t origin = INT32_MAX;
+
+          for (uint64_t i = 0; i < n; i++)
+            {
+              q[i] = quantize(c[d][i], scale);
+              origin = q[i] < origin ? q[i] : origin;
+            }
+
+          for (uint64_t i = 0; i < n; i++)
+            v[i] = (uint32_t)(q[i] - origin);
+
+          frame.origin[d] = origin;
+        }
+      else
+        for (uint64_t i = 0; i < n; i++)
+          {
+            const int32_t q_i = quantize(c[d][i], scale);
+
+            v[i] = zigzag(q_i - q[i]);
+            q[i] = q_i;
+          }
+
+      // Padding values stay 0
+      for (uint64_t b = 0; b < padded_particles(); b += PACK_BLOCK)
+        out += pack_block(v + b, out);
+    }
+
+  frame.size = (uint32_t)(out - t->packed);
+
+  fwrite(&frame, sizeof(struct compressed_frame), 1, t->f);
+  fwrite(t->packed, 1, frame.size, t->f);
+
+  t->n_frames++;
+}
+
+// Buffers of the compressed format
+static void init_compressed(struct trajectory *restrict t,
+                            const double resolution)
+{
+  const uint64_t n = padded_particles();
+
+  t->resolution = resolution;
+  t->n_frames = 0;
+  t->q = aligned_alloc(ALIGN, sizeof(int32_t) * 3 * n);
+  t->v = aligned_alloc(ALIGN, sizeof(uint32_t) * n);
+  t->packed = aligned_alloc(ALIGN, packed_size());
+
+  for (uint64_t i = 0; i < n; i++)
+    t->v[i] = 0;
+}
+
+// Write the frames of the ring until the trajectory is closed
+static void *write_frames(void *arg)
+{
+  struct trajectory *restrict t = arg;
+
+  pthread_mutex_lock(&t->lock);
+
+  while (1)
+    {
+      while (t->head == t->tail && !t->done)
+        pthread_cond_wait(&t->not_empty, &t->lock);
+
+      // Closed and drained
+      if (t->head == t->tail)
+        break;
+
+      const uint64_t s = t->head % TRAJECTORY_SLOTS;
+
+      // Slots from head to tail are only read, write without the lock
+      pthread_mutex_unlock(&t->lock);
+
+      if (t->format == FORMAT_BIN)
+        store_bin(t, t->slot + s, t->ite[s]);
+      else if (t->format == FORMAT_COMPRESSED)
+        store_compressed(t, t->slot + s, t->ite[s]);
+      else
+        store_pdb(t->f, t->slot + s, t->ite[s]);
+
+      pthread_mutex_lock(&t->lock);
+
+      t->head++;
+      pthread_cond_signal(&t->not_full);
+    }
+
+  pthread_mutex_unlock(&t->lock);
+
+  return NULL;
+}
+
+struct trajectory *open_trajectory(const char *filename, const uint64_t format,
+                                   const double resolution,
+                                   const uint64_t offset)
+{
+  // Frames after offset come from an interrupted run
+  if (offset && truncate(filename, offset) != 0)
+    {
+      printf("Error when truncate the file %s\n", filename);
+      exit(ERR_OPEN);
+    }
+
+  struct trajectory *restrict t =
+    init_trajectory(filename, offset ? "a" : "w", format);
+
+  // Ring of frames
+  t->head = 0;
+  t->tail = 0;
+  t->done = 0;
+  t->ite = aligned_alloc(ALIGN, sizeof(uint64_t) * TRAJECTORY_SLOTS);
+  t->slot = aligned_alloc(ALIGN, sizeof(struct particle) * TRAJECTORY_SLOTS);
+
+  for (uint64_t s = 0; s < TRAJECTORY_SLOTS; s++)
+    {
+      t->slot[s].x = aligned_alloc(ALIGN, sizeof(double) * N_PARTICLES_TOTAL);
+      t->slot[s].y = aligned_alloc(ALIGN, sizeof(double) * N_PARTICLES_TOTAL);
+      t->slot[s].z = aligned_alloc(ALIGN, sizeof(double) * N_PARTICLES_TOTAL);
+    }
+
+  pthread_mutex_init(&t->lock, NULL);
+  pthread_cond_init(&t->not_empty, NULL);
+  pthread_cond_init(&t->not_full, NULL);
+
+  if (format == FORMAT_BIN)
+    {
+      // Header, already there when appending
+      struct trajectory_header header =
+        {
+          .magic = TRAJECTORY_MAGIC,
+          .version = TRAJECTORY_VERSION,
+          .n_particles = N_PARTICLES_TOTAL,
+          .box = { L, L, L }
+        };
+
+      if (!offset)
+        fwrite(&header, sizeof(struct trajectory_header), 1, t->f);
+
+      // Positions of a frame, converted to float
+      t->frame = aligned_alloc(ALIGN, sizeof(float) * 3 * N_PARTICLES_TOTAL);
+    }
+  else if (format == FORMAT_COMPRESSED)
+    {
+      // Header, already there when appending. Frames start again from a key
+      // frame
+      struct compressed_header header =
+        {
+          .magic = COMPRESSED_MAGIC,
+          .version = COMPRESSED_VERSION,
+          .n_particles = N_PARTICLES_TOTAL,
+          .box = { L, L, L },
+          .resolution = resolution
+        };
+
+      if (!offset)
+        fwrite(&header, sizeof(struct compressed_header), 1, t->f);
+
+      init_compressed(t, resolution);
+    }
+
+  pthread_create(&t->writer, NULL, write_frames, t);
+
+  return t;
+}
+
+struct trajectory *read_trajectory(const char *filename)
+{
+  struct trajectory *restrict t = init_trajectory(filename, "r", FORMAT_BIN);
+
+  // Header, the format is given by its magic
+  struct compressed_header c;
+  struct trajectory_header header;
+
+  if (fread(&c, sizeof(struct compressed_header), 1, t->f) == 1 &&
+      memcmp(c.magic, COMPRESSED_MAGIC, sizeof(c.magic)) == 0 &&
+      c.version == COMPRESSED_VERSION)
+    {
+      t->format = FORMAT_COMPRESSED;
+
+      N_PARTICLES_TOTAL = c.n_particles;
+      L = c.box[0];
+
+      init_compressed(t, c.resolution);
+
+      return t;
+    }
+
+  rewind(t->f);
+
+  if (fread(&header, sizeof(struct trajectory_header), 1, t->f) != 1 ||
+      memcmp(header.magic, TRAJECTORY_MAGIC, sizeof(header.magic)) != 0 ||
+      header.version != TRAJECTORY_VERSION)
+    {
+      printf("Error: %s is not a binary or compressed trajectory\n", filename);
+      exit(ERR_OPEN);
+    }
+
+  N_PARTICLES_TOTAL = header.n_particles;
+  L = header.box[0];
+
+  t->frame = aligned_alloc(ALIGN, sizeof(float) * 3 * N_PARTICLES_TOTAL);
+
+  return t;
+}
+
+uint64_t flush_trajectory(struct trajectory *restrict t)
+{
+  pthread_mutex_lock(&t->lock);
+
+  while (t->head != t->tail)
+    pthread_cond_wait(&t->not_full, &t->lock);
+
+  pthread_mutex_unlock(&t->lock);
+
+  fflush(t->f);
 
-  // Close file
-  fclose(f);
+  return ftell(t->f);
+}
+
+void close_trajectory(struct trajectory *restrict t)
+{
+  // Let the writer thread drain the ring
+  if (t->slot)
+    {
+      pthread_mutex_lock(&t->lock);
+      t->done = 1;
+      pthread_cond_signal(&t->not_empty);
+      pthread_mutex_unlock(&t->lock);
+
+      pthread_join(t->writer, NULL);
+
+      for (uint64_t s = 0; s < TRAJECTORY_SLOTS; s++)
+        {
+          free(t->slot[s].x);
+          free(t->slot[s].y);
+          free(t->slot[s].z);
+        }
+
+      pthread_mutex_destroy(&t->lock);
+      pthread_cond_destroy(&t->not_empty);
+      pthread_cond_destroy(&t->not_full);
+    }
+
+  fclose(t->f);
+
+  free(t->ite);
+  free(t->slot);
+
+  free(t->buffer);
+  free(t->frame);
+  free(t->q);
+  free(t->v);
+  free(t->packed);
+  free(t);
+}
+
+void store_particles(struct trajectory *restrict t,
+                     const struct particle *restrict p,
+                     const uint64_t *restrict id, const uint64_t ite)
+{
+  pthread_mutex_lock(&t->lock);
+
+  // Back-pressure, wait for the writer thread when every slot is taken
+  while (t->tail - t->head == TRAJECTORY_SLOTS)
+    pthread_cond_wait(&t->not_full, &t->lock);
+
+  const uint64_t s = t->tail % TRAJECTORY_SLOTS;
+
+  // The writer thread does not read free slots, copy without the lock
+  pthread_mutex_unlock(&t->lock);
+
+  if (id)
+    for (uint64_t i = 0; i < N_PARTICLES_TOTAL; i++)
+      {
+        t->slot[s].x[id[i]] = p->x[i];
+        t->slot[s].y[id[i]] = p->y[i];
+        t->slot[s].z[id[i]] = p->z[i];
+      }
+  else
+    for (uint64_t i = 0; i < N_PARTICLES_TOTAL; i++)
+      {
+        t->slot[s].x[i] = p->x[i];
+        t->slot[s].y[i] = p->y[i];
+        t->slot[s].z[i] = p->z[i];
+      }
+
+  t->ite[s] = ite;
+
+  pthread_mutex_lock(&t->lock);
+
+  t->tail++;
+  pthread_cond_signal(&t->not_empty);
+
+  pthread_mutex_unlock(&t->lock);
+}
+
+// Next frame of a compressed trajectory
+static uint64_t load_compressed(struct trajectory *restrict t,
+                                struct particle *restrict p,
+                                uint64_t *restrict ite)
+{
+  const uint64_t n = N_PARTICLES_TOTAL;
+  double *restrict c[3] = { p->x, p->y, p->z };
+
+  struct compressed_frame frame;
+
+  if (fread(&frame, sizeof(struct compressed_frame), 1, t->f) != 1 ||
+      frame.size > packed_size() ||
+      fread(t->packed, 1, frame.size, t->f) != frame.size)
+    return 0;
+
+  // The first frame of a file is a key frame
+  if (!frame.keyframe && !t->n_frames)
+    {
+      printf("Error: compressed trajectory does not start with a key frame\n");
+      exit(ERR_OPEN);
+    }
+
+  const uint8_t *restrict in = t->packed;
+  uint32_t *restrict v = t->v;
+
+  for (uint64_t d = 0; d < 3; d++)
+    {
+      int32_t *restrict q = t->q + d * n;
+
+      for (uint64_t b = 0; b < padded_particles(); b += PACK_BLOCK)
+        in += unpack_block(in, v + b);
+
+      if (frame.keyframe)
+        for (uint64_t i = 0; i < n; i++)
+          q[i] = frame.origin[d] + (int32_t)v[i];
+      else
+        for (uint64_t i = 0; i < n; i++)
+          q[i] += unzigzag(v[i]);
+
+      for (uint64_t i = 0; i < n; i++)
+        c[d][i] = q[i] * t->resolution;
+    }
+
+  *ite = frame.ite;
+  t->n_frames++;
+
+  return 1;
+}
+
+uint64_t load_particles(struct trajectory *restrict t,
+                        struct particle *restrict p, uint64_t *restrict ite)
+{
+  const uint64_t n = N_PARTICLES_TOTAL;
+
+  if (t->format == FORMAT_COMPRESSED)
+    return load_compressed(t, p, ite);
+
+  if (fread(ite, sizeof(uint64_t), 1, t->f) != 1 ||
+      fread(t->frame, sizeof(float), 3 * n, t->f) != 3 * n)
+    return 0;
+
+  const float *restrict x = t->frame;
+  const float *restrict y = t->frame + n;
+  const float *restrict z = t->frame + 2 * n;
+
+  for (uint64_t i = 0; i < n; i++)
+    {
+      p->x[i] = x[i];
+      p->y[i] = y[i];
+      p->z[i] = z[i];
+    }
 
-  return;
+  return 1;
 }
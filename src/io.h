@@ -1,19 +1,70 @@
 #ifndef _IO_H_
 #define _IO_H_
 
+// Trajectory formats
+enum
+  {
+    FORMAT_PDB,
+    FORMAT_BIN,
+    FORMAT_COMPRESSED
+  };
+
 /**
- * reset_file - Reset file
+ * open_trajectory - Create file nammed filename, kept open until
+ *                   close_trajectory
+ * @param filename  : file name
+ * @param format    : FORMAT_PDB, FORMAT_BIN or FORMAT_COMPRESSED
+ * @param resolution: quantum of positions in the compressed format, in
+ *                    angstroms
+ * @param offset    : 0 for a new file, else size to keep of an existing file
+ *                    before appending
+ * @return the trajectory
  */
-void reset_file(const char *filename);
+struct trajectory *open_trajectory(const char *filename, const uint64_t format,
+                                   const double resolution,
+                                   const uint64_t offset);
 
 /**
- * store_particles - Store particles in file nammed filename in PDB format
+ * read_trajectory - Open file nammed filename in binary or compressed format
+ *                   for reading and set N_PARTICLES_TOTAL from its header
  * @param filename: file name
- * @param p       : sturct that contain position of particles
- * @param ite     : iteration number
+ * @return the trajectory
+ */
+struct trajectory *read_trajectory(const char *filename);
+
+/**
+ * flush_trajectory - Wait for the writer thread and flush the file
+ * @param t: trajectory
+ * @return size of the file
+ */
+uint64_t flush_trajectory(struct trajectory *restrict t);
+
+/**
+ * close_trajectory - Flush and close the file, release memory
+ * @param t: trajectory
+ */
+void close_trajectory(struct trajectory *restrict t);
+
+/**
+ * store_particles - Append positions of particles to the trajectory
+ * @param t  : trajectory
+ * @param p  : sturct that contain position of particles
+ * @param id : index in the input file of each particle, NULL when in order
+ * @param ite: iteration number
  * @return
  */
-void store_particles(const char *filename, const struct particle *restrict p,
-                     const uint64_t ite);
+void store_particles(struct trajectory *restrict t,
+                     const struct particle *restrict p,
+                     const uint64_t *restrict id, const uint64_t ite);
+
+/**
+ * load_particles - Read the next frame of a binary or compressed trajectory
+ * @param t  : trajectory
+ * @param p  : sturct filled with position of particles
+ * @param ite: filled with iteration number
+ * @return 1 when a frame was read, 0 at the end of the file
+ */
+uint64_t load_particles(struct trajectory *restrict t,
+                        struct particle *restrict p, uint64_t *restrict ite);
 
 #endif // _IO_H_
@@ -1,7 +1,14 @@
 #include <stdlib.h>
+#include <math.h>
+#include <omp.h>
 
 #include "helper.h"
 #include "common.h"
+#include "arena.h"
+#include "cell_list.h"
+#include "neighbour_list.h"
+#include "pair_kernel.h"
+#include "domain.h"
 #include "lennard_jones.h"
 
 //
@@ -10,20 +17,26 @@ static void reset_lennard_jones(struct lennard_jones *lj)
   // Init energy to 0
   lj->energy = 0.0;
 
+  double *restrict fx = lj->sum_i->fx;
+  double *restrict fy = lj->sum_i->fy;
+  double *restrict fz = lj->sum_i->fz;
+
   // Init force
   for (uint64_t i = 0; i < N_PARTICLES_LOCAL; i++)
     {
+#if FORCE_MATRIX
       for (uint64_t j = 0; j < N_PARTICLES_LOCAL; j++)
         {
           lj->f[i][j].fx = 0.0;
           lj->f[i][j].fy = 0.0;
           lj->f[i][j].fz = 0.0;
         }
+#endif
 
       // Init sum of force apply on particle i to 0
-      lj->sum_i[i].fx = 0.0;
-      lj->sum_i[i].fy = 0.0;
-      lj->sum_i[i].fz = 0.0;
+      fx[i] = 0.0;
+      fy[i] = 0.0;
+      fz[i] = 0.0;
     }
 
   // Init sum of force to 0
@@ -32,21 +45,96 @@ static void reset_lennard_jones(struct lennard_jones *lj)
   lj->sum->fz = 0.0;
 }
 
+//
+static void sum_lennard_jones(struct lennard_jones *lj)
+{
+  for (uint64_t i = 0; i < N_PARTICLES_LOCAL; i++)
+    {
+      lj->sum->fx += lj->sum_i->fx[i];
+      lj->sum->fy += lj->sum_i->fy[i];
+      lj->sum->fz += lj->sum_i->fz[i];
+    }
+}
+
+// Zeroed force buffer of the calling thread, inside a parallel region
+static struct forces *thread_forces(struct lennard_jones *lj)
+{
+  struct forces *restrict f = lj->sum_t[omp_get_thread_num()];
+
+  for (uint64_t i = 0; i < N_PARTICLES_LOCAL; i++)
+    {
+      f->fx[i] = 0.0;
+      f->fy[i] = 0.0;
+      f->fz[i] = 0.0;
+    }
+
+  return f;
+}
+
+// Add the force buffers of the threads to sum_i, inside a parallel region.
+// Buffers are in cell order when index is set
+static void reduce_lennard_jones(struct lennard_jones *lj,
+                                 const uint64_t *restrict index)
+{
+#pragma omp for schedule(static)
+  for (uint64_t a = 0; a < N_PARTICLES_LOCAL; a++)
+    {
+      struct force sum_a =
+        {
+          .fx = 0.0,
+          .fy = 0.0,
+          .fz = 0.0
+        };
+
+      for (uint64_t t = 0; t < lj->n_threads; t++)
+        {
+          sum_a.fx += lj->sum_t[t]->fx[a];
+          sum_a.fy += lj->sum_t[t]->fy[a];
+          sum_a.fz += lj->sum_t[t]->fz[a];
+        }
+
+      const uint64_t i = index ? index[a] : a;
+
+      lj->sum_i->fx[i] += sum_a.fx;
+      lj->sum_i->fy[i] += sum_a.fy;
+      lj->sum_i->fz[i] += sum_a.fz;
+    }
+}
+
 //
 struct lennard_jones *init_lennard_jones(void)
 {
   // Allocate memory
   struct lennard_jones *restrict lj =
-    aligned_alloc(ALIGN, sizeof(struct lennard_jones));
+    arena_alloc(sizeof(struct lennard_jones));
 
-  lj->f =
-    aligned_alloc(ALIGN, sizeof(struct force *restrict) * N_PARTICLES_LOCAL);
+#if FORCE_MATRIX
+  // Rows of one block
+  lj->f = arena_alloc(sizeof(struct force *restrict) * N_PARTICLES_LOCAL);
+  lj->f[0] = arena_alloc(sizeof(struct force) * N_PARTICLES_LOCAL * N_PARTICLES_LOCAL);
 
-  for (uint64_t i = 0; i < N_PARTICLES_LOCAL; i++)
-    lj->f[i] = aligned_alloc(ALIGN, sizeof(struct force) * N_PARTICLES_LOCAL);
+  for (uint64_t i = 1; i < N_PARTICLES_LOCAL; i++)
+    lj->f[i] = lj->f[0] + i * N_PARTICLES_LOCAL;
+#endif
+
+  lj->sum_i = init_forces(N_PARTICLES_LOCAL);
+  lj->sum = arena_alloc(sizeof(struct force));
 
-  lj->sum_i = aligned_alloc(ALIGN, sizeof(struct force) * N_PARTICLES_LOCAL);
-  lj->sum = aligned_alloc(ALIGN, sizeof(struct force));
+  // One force buffer per thread, so that Newton's third law needs no atomics
+  lj->n_threads = omp_get_max_threads();
+  lj->sum_t = arena_alloc(sizeof(struct forces *) * lj->n_threads);
+
+  for (uint64_t t = 0; t < lj->n_threads; t++)
+    lj->sum_t[t] = init_forces(N_PARTICLES_LOCAL);
+
+  lj->cl = NULL;
+  lj->nl = NULL;
+#if MPI
+  lj->dd = NULL;
+#endif
+  lj->precision = PRECISION;
+  lj->kernel = select_pair_kernel(lj->precision);
+  lj->engine = NULL;
 
   // Set to 0
   reset_lennard_jones(lj);
@@ -54,16 +142,61 @@ struct lennard_jones *init_lennard_jones(void)
   return lj;
 }
 
+//
+struct lennard_jones *init_periodical_lennard_jones(const double r_cut,
+                                                    const double skin)
+{
+  struct lennard_jones *restrict plj = init_lennard_jones();
+
+  // Cell list, when the box is large enough compared to r_cut
+  plj->cl = init_cell_list(r_cut);
+
+  // Neighbour list, when a skin is requested
+  plj->nl = init_neighbour_list(r_cut, skin);
+
+  return plj;
+}
+
+#if MPI
+//
+struct lennard_jones *init_domain_lennard_jones(const double r_cut)
+{
+  struct lennard_jones *restrict plj = init_lennard_jones();
+
+  // Force buffers are sized for every particle, enough for the local
+  // particles and their ghosts
+  plj->dd = init_domain(r_cut);
+
+  return plj;
+}
+#endif
+
 //
 void free_lennard_jones(struct lennard_jones *restrict lj)
 {
-  for (uint64_t i = 0; i < N_PARTICLES_LOCAL; i++)
-    free(lj->f[i]);
+#if FORCE_MATRIX
+  arena_free(lj->f[0]);
+  arena_free(lj->f);
+#endif
+
+  if (lj->cl)
+    free_cell_list(lj->cl);
 
-  free(lj->sum_i);
-  free(lj->sum);
-  free(lj->f);
-  free(lj);
+  if (lj->nl)
+    free_neighbour_list(lj->nl);
+
+#if MPI
+  if (lj->dd)
+    free_domain(lj->dd);
+#endif
+
+  for (uint64_t t = 0; t < lj->n_threads; t++)
+    free_forces(lj->sum_t[t]);
+
+  arena_free(lj->sum_t);
+  free_forces(lj->sum_i);
+  arena_free(lj->sum);
+  arena_free(lj);
 }
 
 //
@@ -73,58 +206,350 @@ void lennard_jones(struct lennard_jones *restrict lj,
   // Set to 0
   reset_lennard_jones(lj);
 
-  // Compute
-  for (uint64_t i = 0; i < N_PARTICLES_LOCAL; i++)
-    {
-      for (uint64_t j = i + 1; j < N_PARTICLES_LOCAL; j++)
-        {
-          const double distance = compute_square_distance_3D(p + i, p + j);
-
-          const double R_STAR_distance = square(R_STAR) / distance;
+  // Accumulate in registers
+  double energy = 0.0;
+
+#pragma omp parallel num_threads(lj->n_threads) reduction(+:energy)
+  {
+    struct forces *restrict f = thread_forces(lj);
+
+    // Compute, particle i with every particle j > i. Rows get shorter with
+    // i, small chunks spread them evenly
+#pragma omp for schedule(static, 8)
+    for (uint64_t i = 0; i < N_PARTICLES_LOCAL; i++)
+      {
+        const struct pair_row row =
+          {
+            .xi = p->x[i],
+            .yi = p->y[i],
+            .zi = p->z[i],
+            .x = p->x + i + 1,
+            .y = p->y + i + 1,
+            .z = p->z + i + 1,
+            .fx = f->fx + i + 1,
+            .fy = f->fy + i + 1,
+            .fz = f->fz + i + 1,
+            .n = N_PARTICLES_LOCAL - i - 1,
+            .wrap = 0,
+            .tv = { .x = 0.0, .y = 0.0, .z = 0.0 },
+            .r_cut_2 = INFINITY,
+#if FORCE_MATRIX
+            .i = i,
+            .j = i + 1,
+            .index = NULL,
+            .f = lj->f
+#endif
+          };
+
+        struct force sum_i =
+          {
+            .fx = 0.0,
+            .fy = 0.0,
+            .fz = 0.0
+          };
+
+        lj->kernel(&row, &sum_i, &energy);
+
+        f->fx[i] += sum_i.fx;
+        f->fy[i] += sum_i.fy;
+        f->fz[i] += sum_i.fz;
+      }
+
+    reduce_lennard_jones(lj, NULL);
+  }
 
-          const double u_ij =
-            (hexa(R_STAR_distance) - 2.0 * cube(R_STAR_distance));
+  // Update sum
+  sum_lennard_jones(lj);
 
-          // Update energy
-          lj->energy += u_ij;
+  // Update energy
+  lj->energy = 4.0 * EPSILON_STAR * energy;
+}
 
-          // Update forces
-          const double du_ij =
-            -48.0 * EPSILON_STAR * (septa(R_STAR_distance) - quad(R_STAR_distance));
+// Periodical lennard jones visiting only the cells around each particle. The
+// 27 neighbouring cells are numbered like the translation vectors, 13 being
+// the cell itself, so that the cells after 13 form half of the neighbourhood
+// and each pair of cells is visited once
+static void cell_lennard_jones(struct lennard_jones *restrict plj,
+                               const double r_cut)
+{
+  const struct cell_list *restrict cl = plj->cl;
+  const int64_t n_cells = (int64_t)cl->n_cells;
+
+  // Accumulate in registers
+  double energy = 0.0;
+
+#pragma omp parallel num_threads(plj->n_threads) reduction(+:energy)
+  {
+    // Forces are accumulated in cell order, then scattered
+    struct forces *restrict f = thread_forces(plj);
+
+#pragma omp for schedule(static)
+    for (int64_t c = 0; c < cube(n_cells); c++)
+      {
+        const int64_t cx = c / square(n_cells);
+        const int64_t cy = (c / n_cells) % n_cells;
+        const int64_t cz = c % n_cells;
+
+        // Neighbouring cells, wrapped with the matching translation
+        for (int64_t o = 13; o < 27; o++)
+          {
+            const int64_t nx = cx + o / 9 - 1;
+            const int64_t ny = cy + (o / 3) % 3 - 1;
+            const int64_t nz = cz + o % 3 - 1;
+
+            const struct translation_vector tv =
+              {
+                .x = nx < 0 ? -L : (nx >= n_cells ? L : 0.0),
+                .y = ny < 0 ? -L : (ny >= n_cells ? L : 0.0),
+                .z = nz < 0 ? -L : (nz >= n_cells ? L : 0.0)
+              };
+
+            const uint64_t nc =
+              cell_id(cl,
+                      (nx + n_cells) % n_cells,
+                      (ny + n_cells) % n_cells,
+                      (nz + n_cells) % n_cells);
+
+            for (uint64_t a = cl->cell_start[c]; a < cl->cell_start[c + 1]; a++)
+              {
+                // Inside the cell itself, only pairs a < b
+                const uint64_t first = o == 13 ? a + 1 : cl->cell_start[nc];
+                const uint64_t last = cl->cell_start[nc + 1];
+
+                if (first >= last)
+                  continue;
+
+                const struct pair_row row =
+                  {
+                    .xi = cl->w->x[a],
+                    .yi = cl->w->y[a],
+                    .zi = cl->w->z[a],
+                    .x = cl->w->x + first,
+                    .y = cl->w->y + first,
+                    .z = cl->w->z + first,
+                    .fx = f->fx + first,
+                    .fy = f->fy + first,
+                    .fz = f->fz + first,
+                    .n = last - first,
+                    .wrap = 0,
+                    .tv = tv,
+                    .r_cut_2 = square(r_cut),
+#if FORCE_MATRIX
+                    .i = cl->index[a],
+                    .j = 0,
+                    .index = cl->index + first,
+                    .f = plj->f
+#endif
+                  };
+
+                struct force sum_i =
+                  {
+                    .fx = 0.0,
+                    .fy = 0.0,
+                    .fz = 0.0
+                  };
+
+                plj->kernel(&row, &sum_i, &energy);
+
+                f->fx[a] += sum_i.fx;
+                f->fy[a] += sum_i.fy;
+                f->fz[a] += sum_i.fz;
+              }
+          }
+      }
+
+    // Scatter forces to particles
+    reduce_lennard_jones(plj, cl->index);
+  }
 
-          // Update force on particle i with j
-          lj->f[i][j].fx = du_ij * (p[i].x - p[j].x);
-          lj->f[i][j].fy = du_ij * (p[i].y - p[j].y);
-          lj->f[i][j].fz = du_ij * (p[i].z - p[j].z);
+  // Update energy
+  plj->energy = 4.0 * EPSILON_STAR * energy;
+}
 
-          // Update force on particle j with i
-          lj->f[j][i].fx = - lj->f[i][j].fx;
-          lj->f[j][i].fy = - lj->f[i][j].fy;
-          lj->f[j][i].fz = - lj->f[i][j].fz;
+// Periodical lennard jones on the minimum image of every pair i < j, shifted
+// by the n translation vectors when r_cut reaches further than L / 2
+static void image_lennard_jones(struct lennard_jones *restrict plj,
+                                const struct particle *restrict p,
+                                const struct translation_vector *restrict tv,
+                                const double r_cut, const uint64_t n)
+{
+  // Accumulate in registers
+  double energy = 0.0;
+
+#pragma omp parallel num_threads(plj->n_threads) reduction(+:energy)
+  {
+    struct forces *restrict f = thread_forces(plj);
+
+#pragma omp for schedule(static, 8)
+    for (uint64_t i = 0; i < N_PARTICLES_LOCAL; i++)
+      {
+        struct force sum_i =
+          {
+            .fx = 0.0,
+            .fy = 0.0,
+            .fz = 0.0
+          };
+
+        for (uint64_t k = 0; k < n; k++)
+          {
+            const struct pair_row row =
+              {
+                .xi = p->x[i],
+                .yi = p->y[i],
+                .zi = p->z[i],
+                .x = p->x + i + 1,
+                .y = p->y + i + 1,
+                .z = p->z + i + 1,
+                .fx = f->fx + i + 1,
+                .fy = f->fy + i + 1,
+                .fz = f->fz + i + 1,
+                .n = N_PARTICLES_LOCAL - i - 1,
+                .wrap = 1,
+                .tv = tv[k],
+                .r_cut_2 = square(r_cut),
+#if FORCE_MATRIX
+                .i = i,
+                .j = i + 1,
+                .index = NULL,
+                .f = plj->f
+#endif
+              };
+
+            plj->kernel(&row, &sum_i, &energy);
+          }
+
+        f->fx[i] += sum_i.fx;
+        f->fy[i] += sum_i.fy;
+        f->fz[i] += sum_i.fz;
+      }
+
+    reduce_lennard_jones(plj, NULL);
+  }
 
-          // Update sum
-          lj->sum_i[i].fx += lj->f[i][j].fx;
-          lj->sum_i[i].fy += lj->f[i][j].fy;
-          lj->sum_i[i].fz += lj->f[i][j].fz;
+  // Update energy
+  plj->energy = 4.0 * EPSILON_STAR * energy;
+}
 
-          lj->sum_i[j].fx += lj->f[j][i].fx;
-          lj->sum_i[j].fy += lj->f[j][i].fy;
-          lj->sum_i[j].fz += lj->f[j][i].fz;
-        }
+// Potential of a pair at square distance, its derivative in du_ij, with the
+// powers of the distance in single precision when mixed
+static inline double pair_potential(const double distance,
+                                    const uint64_t mixed,
+                                    double *restrict du_ij)
+{
+  if (mixed)
+    {
+      const float R_STAR_distance = (float)square(R_STAR) / (float)distance;
 
-      // Update force on particle i with i
-      lj->f[i][i].fx = 0.0;
-      lj->f[i][i].fy = 0.0;
-      lj->f[i][i].fz = 0.0;
+      *du_ij =
+        -48.0f * (float)EPSILON_STAR * (septa(R_STAR_distance) - quad(R_STAR_distance));
 
-      // Update sum
-      lj->sum->fx += lj->sum_i[i].fx;
-      lj->sum->fy += lj->sum_i[i].fy;
-      lj->sum->fz += lj->sum_i[i].fz;
+      return (hexa(R_STAR_distance) - 2.0f * cube(R_STAR_distance));
     }
 
+  const double R_STAR_distance = square(R_STAR) / distance;
+
+  *du_ij =
+    -48.0 * EPSILON_STAR * (septa(R_STAR_distance) - quad(R_STAR_distance));
+
+  return (hexa(R_STAR_distance) - 2.0 * cube(R_STAR_distance));
+}
+
+// Periodical lennard jones over the pairs of the neighbour list
+static void neighbour_lennard_jones(struct lennard_jones *restrict plj,
+                                    const struct particle *restrict p,
+                                    const double r_cut)
+{
+  const struct neighbour_list *restrict nl = plj->nl;
+  const uint64_t mixed = plj->precision == PRECISION_MIXED;
+
+  const double *restrict x = p->x;
+  const double *restrict y = p->y;
+  const double *restrict z = p->z;
+
+  // Accumulate in registers
+  double energy = 0.0;
+
+#pragma omp parallel num_threads(plj->n_threads) reduction(+:energy)
+  {
+    struct forces *restrict f = thread_forces(plj);
+
+    double *restrict fx = f->fx;
+    double *restrict fy = f->fy;
+    double *restrict fz = f->fz;
+
+#pragma omp for schedule(static, 64)
+    for (uint64_t i = 0; i < N_PARTICLES_LOCAL; i++)
+      {
+        struct force sum_i =
+          {
+            .fx = 0.0,
+            .fy = 0.0,
+            .fz = 0.0
+          };
+
+        for (uint64_t k = nl->start[i]; k < nl->start[i + 1]; k++)
+          {
+            const uint64_t j = nl->j[k];
+
+            // Image of j seen from i
+            const struct translation_vector d =
+              {
+                .x = x[i] - x[j] + nl->image[3 * k + 0] * L,
+                .y = y[i] - y[j] + nl->image[3 * k + 1] * L,
+                .z = z[i] - z[j] + nl->image[3 * k + 2] * L
+              };
+
+            const double distance = square(d.x) + square(d.y) + square(d.z);
+
+            // Test if the distance is under r_cut and then ignore this step
+            if (distance > square(r_cut))
+              continue;
+
+            double du_ij;
+
+            // Update energy
+            energy += pair_potential(distance, mixed, &du_ij);
+
+            // Force on particle i with j
+            const struct force f_ij =
+              {
+                .fx = du_ij * d.x,
+                .fy = du_ij * d.y,
+                .fz = du_ij * d.z
+              };
+
+#if FORCE_MATRIX
+            // Update force on particle i with j
+            plj->f[i][j].fx += f_ij.fx;
+            plj->f[i][j].fy += f_ij.fy;
+            plj->f[i][j].fz += f_ij.fz;
+
+            // Update force on particle j with i
+            plj->f[j][i].fx -= f_ij.fx;
+            plj->f[j][i].fy -= f_ij.fy;
+            plj->f[j][i].fz -= f_ij.fz;
+#endif
+
+            // Update sum
+            sum_i.fx += f_ij.fx;
+            sum_i.fy += f_ij.fy;
+            sum_i.fz += f_ij.fz;
+
+            fx[j] -= f_ij.fx;
+            fy[j] -= f_ij.fy;
+            fz[j] -= f_ij.fz;
+          }
+
+        fx[i] += sum_i.fx;
+        fy[i] += sum_i.fy;
+        fz[i] += sum_i.fz;
+      }
+
+    reduce_lennard_jones(plj, NULL);
+  }
+
   // Update energy
-  lj->energy *= 4.0 * EPSILON_STAR;
+  plj->energy = 4.0 * EPSILON_STAR * energy;
 }
 
 //
@@ -136,67 +561,123 @@ void periodical_lennard_jones(struct lennard_jones *restrict plj,
   // Set to 0
   reset_lennard_jones(plj);
 
-  // Compute
-  for (uint64_t k = 0; k < n; k++)
+  // Compute, with the neighbour list built for r_cut, else with the cell
+  // list when its cells are wide enough for r_cut
+  if (plj->nl && plj->nl->r_cut == r_cut)
     {
-      for (uint64_t i = 0; i < N_PARTICLES_LOCAL; i++)
-        {
-          for (uint64_t j = 0; j < N_PARTICLES_LOCAL; j++)
-            {
-              // Test if i == j and then ignore this step
-              if (i == j)
-                continue;
-
-              const struct particle tmp_j =
-                {
-                  .x = p[j].x + tv[k].x,
-                  .y = p[j].y + tv[k].y,
-                  .z = p[j].z + tv[k].z
-                };
-
-              const double distance = compute_square_distance_3D(p + i, &tmp_j);
-
-              // Test if the distance is under r_cut and then ignore this step
-              if (distance > square(r_cut))
-                continue;
-
-              const double R_STAR_distance = square(R_STAR) / distance;
-
-              const double u_ij =
-                (hexa(R_STAR_distance) - 2.0 * cube(R_STAR_distance));
-
-              // Update energy
-              plj->energy += u_ij;
-
-              // Update forces
-              const double du_ij =
-                -48.0 * EPSILON_STAR * (septa(R_STAR_distance) - quad(R_STAR_distance));
-
-              // Update force on particle i with j
-              plj->f[i][j].fx += du_ij * (p[i].x - tmp_j.x);
-              plj->f[i][j].fy += du_ij * (p[i].y - tmp_j.y);
-              plj->f[i][j].fz += du_ij * (p[i].z - tmp_j.z);
-            }
-        }
+      update_neighbour_list(plj->nl, p);
+      neighbour_lennard_jones(plj, p, r_cut);
+    }
+  else if (plj->cl && plj->cl->side >= r_cut)
+    {
+      build_cell_list(plj->cl, p);
+      cell_lennard_jones(plj, r_cut);
     }
+  else
+    image_lennard_jones(plj, p, tv, r_cut, n);
 
   // Update sum
-  for (uint64_t i = 0; i < N_PARTICLES_LOCAL; i++)
-    {
-      // Update sum_i
-      for (uint64_t j = 0; j < N_PARTICLES_LOCAL; j++)
-        {
-          plj->sum_i[i].fx += plj->f[i][j].fx;
-          plj->sum_i[i].fy += plj->f[i][j].fy;
-          plj->sum_i[i].fz += plj->f[i][j].fz;
-        }
+  sum_lennard_jones(plj);
+}
 
-      // Update sum
-      plj->sum->fx += plj->sum_i[i].fx;
-      plj->sum->fy += plj->sum_i[i].fy;
-      plj->sum->fz += plj->sum_i[i].fz;
-    }
+#if MPI
+//
+void domain_lennard_jones(struct lennard_jones *restrict plj,
+                          struct particle *restrict p, const double r_cut)
+{
+  // Set to 0
+  reset_lennard_jones(plj);
+
+  // Ghosts, after the local particles
+  exchange_ghosts(plj->dd, p);
+
+  const uint64_t n_ghosts = plj->dd->n_ghosts;
+
+  // Accumulate in registers, pairs with a ghost are also computed by the
+  // subdomain owning the ghost
+  double energy = 0.0;
+  double energy_ghosts = 0.0;
+
+#pragma omp parallel num_threads(plj->n_threads) reduction(+:energy, energy_ghosts)
+  {
+    struct forces *restrict f = thread_forces(plj);
+
+    // Forces on ghosts are dropped, but still accumulated by the kernels
+    for (uint64_t g = N_PARTICLES_LOCAL; g < N_PARTICLES_LOCAL + n_ghosts; g++)
+      {
+        f->fx[g] = 0.0;
+        f->fy[g] = 0.0;
+        f->fz[g] = 0.0;
+      }
+
+#pragma omp for schedule(static, 8)
+    for (uint64_t i = 0; i < N_PARTICLES_LOCAL; i++)
+      {
+        struct force sum_i =
+          {
+            .fx = 0.0,
+            .fy = 0.0,
+            .fz = 0.0
+          };
+
+        // Local particles j > i
+        const struct pair_row row =
+          {
+            .xi = p->x[i],
+            .yi = p->y[i],
+            .zi = p->z[i],
+            .x = p->x + i + 1,
+            .y = p->y + i + 1,
+            .z = p->z + i + 1,
+            .fx = f->fx + i + 1,
+            .fy = f->fy + i + 1,
+            .fz = f->fz + i + 1,
+            .n = N_PARTICLES_LOCAL - i - 1,
+            .wrap = 1,
+            .tv = { .x = 0.0, .y = 0.0, .z = 0.0 },
+            .r_cut_2 = square(r_cut)
+          };
+
+        plj->kernel(&row, &sum_i, &energy);
+
+        // Ghosts
+        const struct pair_row row_ghosts =
+          {
+            .xi = p->x[i],
+            .yi = p->y[i],
+            .zi = p->z[i],
+            .x = p->x + N_PARTICLES_LOCAL,
+            .y = p->y + N_PARTICLES_LOCAL,
+            .z = p->z + N_PARTICLES_LOCAL,
+            .fx = f->fx + N_PARTICLES_LOCAL,
+            .fy = f->fy + N_PARTICLES_LOCAL,
+            .fz = f->fz + N_PARTICLES_LOCAL,
+            .n = n_ghosts,
+            .wrap = 1,
+            .tv = { .x = 0.0, .y = 0.0, .z = 0.0 },
+            .r_cut_2 = square(r_cut)
+          };
+
+        plj->kernel(&row_ghosts, &sum_i, &energy_ghosts);
+
+        f->fx[i] += sum_i.fx;
+        f->fy[i] += sum_i.fy;
+        f->fz[i] += sum_i.fz;
+      }
+
+    reduce_lennard_jones(plj, NULL);
+  }
+
+  // Update sum
+  sum_lennard_jones(plj);
+
+  // Sum over the subdomains
+  energy += 0.5 * energy_ghosts;
+
+  MPI_Allreduce(MPI_IN_PLACE, &energy, 1, MPI_DOUBLE, MPI_SUM, plj->dd->comm);
+  MPI_Allreduce(MPI_IN_PLACE, plj->sum, 3, MPI_DOUBLE, MPI_SUM, plj->dd->comm);
 
   // Update energy
-  plj->energy *= 2.0 * EPSILON_STAR;
+  plj->energy = 4.0 * EPSILON_STAR * energy;
 }
+#endif
@@ -4,6 +4,16 @@
 //
 struct lennard_jones *init_lennard_jones(void);
 
+// Same as init_lennard_jones, with a cell list sized for r_cut and a
+// neighbour list when skin is positive
+struct lennard_jones *init_periodical_lennard_jones(const double r_cut,
+                                                    const double skin);
+
+#if MPI
+// Same as init_lennard_jones, over the subdomain of the process
+struct lennard_jones *init_domain_lennard_jones(const double r_cut);
+#endif
+
 //
 void free_lennard_jones(struct lennard_jones *restrict lj);
 
@@ -17,4 +27,11 @@ void periodical_lennard_jones(struct lennard_jones *restrict plj,
                               const struct translation_vector *restrict tv,
                               const double r_cut, const uint64_t n);
 
+#if MPI
+// Periodical lennard jones over the local particles and their ghosts, energy
+// and sum of forces are summed over every process
+void domain_lennard_jones(struct lennard_jones *restrict plj,
+                          struct particle *restrict p, const double r_cut);
+#endif
+
 #endif // _LENNARD_JONES_H_
@@ -2,27 +2,68 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <math.h>
 #include <time.h>
+#include <omp.h>
 
 #include "helper.h"
 #include "common.h"
 #include "lennard_jones.h"
+#include "force_engine.h"
+#include "neighbour_list.h"
+#include "domain.h"
+#include "pair_kernel.h"
 #include "velocity_verlet.h"
 #include "io.h"
+#include "checkpoint.h"
+#include "reorder.h"
+#include "ensemble.h"
+#include "arena.h"
+#include "timer.h"
+#include "perf_counter.h"
 #include "arguments.h"
 
 // Global variable
+double L = 50.0;
 uint64_t N_PARTICLES_TOTAL = 0;
 uint64_t N_PARTICLES_LOCAL = 0;
 uint64_t LOCAL_EQUAL_TOTAL = 1;
 uint64_t N_DL = 0;
 uint64_t N_STEP = 10000;
 uint64_t M_STEP = 100;
+uint64_t OUTPUT_STRIDE = 1;
 double R_CUT = 10.0;
+double SKIN = 2.0;
+uint64_t N_THREADS = 0;
+uint64_t RANK = 0;
+uint64_t SEED = 0;
+uint64_t PRECISION = PRECISION_DOUBLE;
+uint64_t CHECKPOINT_STRIDE = 1000;
+uint64_t PERF_COUNTERS = 0;
+uint64_t SORT_EVERY = 0;
+uint64_t N_REPLICAS = 16;
+uint64_t HUGE_PAGES = 0;
+
+// Runs, all by default
+enum
+  {
+    RUN_LENNARD_JONES = 1,
+    RUN_PERIODICAL_LENNARD_JONES = 2,
+    RUN_VELOCITY_VERLET = 4,
+    RUN_DRIFT = 8,
+    RUN_ENSEMBLE = 16
+  };
+
+uint64_t RUN = RUN_LENNARD_JONES | RUN_PERIODICAL_LENNARD_JONES | RUN_VELOCITY_VERLET;
+const struct force_engine *FORCE_ENGINE = NULL;
 
 const char *const VERSION = "1.0.0";
 char INPUT_FILE[256] = "";
 char OUTPUT_FILE[256] = "output.pdb";
+uint64_t OUTPUT_FORMAT = FORMAT_PDB;
+double RESOLUTION = 0.001;
+char CHECKPOINT_FILE[256] = "";
+char RESTART_FILE[256] = "";
 
 // Structure to monitoring simulation
 struct timespec simulation_clock;
@@ -63,6 +104,112 @@ int select_output(const char *const arg)
   return EXIT_SUCCESS;
 }
 
+int select_format(const char *const arg)
+{
+  //
+  const char *ptr = strchr(arg, '=');
+  const char *value = ++ptr;
+
+  if (strcmp(value, "pdb") == 0)
+    OUTPUT_FORMAT = FORMAT_PDB;
+  else if (strcmp(value, "bin") == 0)
+    OUTPUT_FORMAT = FORMAT_BIN;
+  else if (strcmp(value, "compressed") == 0)
+    OUTPUT_FORMAT = FORMAT_COMPRESSED;
+  else
+    {
+      printf("Unrecognized format: %s\n", value);
+      exit(ERR_USAGE);
+    }
+
+  return EXIT_SUCCESS;
+}
+
+int select_resolution(const char *const arg)
+{
+  //
+  const char *ptr = strchr(arg, '=');
+  const double value = atof(++ptr);
+
+  if (value <= 0.0)
+    {
+      printf("Resolution must be positive: %s\n", ptr);
+      exit(ERR_USAGE);
+    }
+
+  RESOLUTION = value;
+  return EXIT_SUCCESS;
+}
+
+int select_engine(const char *const arg)
+{
+  //
+  const char *ptr = strchr(arg, '=');
+  const char *value = ++ptr;
+
+  FORCE_ENGINE = find_force_engine(value);
+
+  if (!FORCE_ENGINE)
+    {
+      printf("Unrecognized engine: %s, use one of ", value);
+      print_force_engines();
+      exit(ERR_USAGE);
+    }
+
+  return EXIT_SUCCESS;
+}
+
+int select_run(const char *const arg)
+{
+  //
+  const char *ptr = strchr(arg, '=');
+  char value[256];
+  strncpy(value, ++ptr, sizeof(value) - 1);
+  value[sizeof(value) - 1] = '\0';
+
+  RUN = 0;
+
+  for (char *run = strtok(value, ","); run; run = strtok(NULL, ","))
+    {
+      if (strcmp(run, "lj") == 0)
+        RUN |= RUN_LENNARD_JONES;
+      else if (strcmp(run, "plj") == 0)
+        RUN |= RUN_PERIODICAL_LENNARD_JONES;
+      else if (strcmp(run, "vv") == 0)
+        RUN |= RUN_VELOCITY_VERLET;
+      else if (strcmp(run, "drift") == 0)
+        RUN |= RUN_DRIFT;
+      else if (strcmp(run, "ensemble") == 0)
+        RUN |= RUN_ENSEMBLE;
+      else
+        {
+          printf("Unrecognized run: %s, use lj, plj, vv, drift or ensemble\n", run);
+          exit(ERR_USAGE);
+        }
+    }
+
+  return EXIT_SUCCESS;
+}
+
+int select_precision(const char *const arg)
+{
+  //
+  const char *ptr = strchr(arg, '=');
+  const char *value = ++ptr;
+
+  if (strcmp(value, "double") == 0)
+    PRECISION = PRECISION_DOUBLE;
+  else if (strcmp(value, "mixed") == 0)
+    PRECISION = PRECISION_MIXED;
+  else
+    {
+      printf("Unrecognized precision: %s\n", value);
+      exit(ERR_USAGE);
+    }
+
+  return EXIT_SUCCESS;
+}
+
 int select_n_step(const char *const arg)
 {
   //
@@ -72,6 +219,51 @@ int select_n_step(const char *const arg)
   return EXIT_SUCCESS;
 }
 
+int select_output_stride(const char *const arg)
+{
+  //
+  const char *ptr = strchr(arg, '=');
+  const uint64_t value = atoll(++ptr);
+  OUTPUT_STRIDE = value ? value : 1;
+  return EXIT_SUCCESS;
+}
+
+int select_checkpoint(const char *const arg)
+{
+  //
+  const char *ptr = strchr(arg, '=');
+  const char *value = ++ptr;
+  strcpy(CHECKPOINT_FILE, value);
+  return EXIT_SUCCESS;
+}
+
+int select_checkpoint_stride(const char *const arg)
+{
+  //
+  const char *ptr = strchr(arg, '=');
+  const uint64_t value = atoll(++ptr);
+  CHECKPOINT_STRIDE = value ? value : 1;
+  return EXIT_SUCCESS;
+}
+
+int select_restart(const char *const arg)
+{
+  //
+  const char *ptr = strchr(arg, '=');
+  const char *value = ++ptr;
+  strcpy(RESTART_FILE, value);
+  return EXIT_SUCCESS;
+}
+
+int select_box(const char *const arg)
+{
+  //
+  const char *ptr = strchr(arg, '=');
+  const double value = atof(++ptr);
+  L = value;
+  return EXIT_SUCCESS;
+}
+
 int select_r_cut(const char *const arg)
 {
   //
@@ -81,6 +273,67 @@ int select_r_cut(const char *const arg)
   return EXIT_SUCCESS;
 }
 
+int select_skin(const char *const arg)
+{
+  //
+  const char *ptr = strchr(arg, '=');
+  const double value = atof(++ptr);
+  SKIN = value;
+  return EXIT_SUCCESS;
+}
+
+int select_seed(const char *const arg)
+{
+  //
+  const char *ptr = strchr(arg, '=');
+  const uint64_t value = atoll(++ptr);
+  SEED = value;
+  return EXIT_SUCCESS;
+}
+
+int select_sort_every(const char *const arg)
+{
+  //
+  const char *ptr = strchr(arg, '=');
+  const uint64_t value = atoll(++ptr);
+  SORT_EVERY = value;
+  return EXIT_SUCCESS;
+}
+
+int select_replicas(const char *const arg)
+{
+  //
+  const char *ptr = strchr(arg, '=');
+  const uint64_t value = atoll(++ptr);
+  N_REPLICAS = value ? value : 1;
+  return EXIT_SUCCESS;
+}
+
+int select_huge_pages(__attribute__ ((unused)) const char *const arg)
+{
+  HUGE_PAGES = 1;
+  return EXIT_SUCCESS;
+}
+
+int select_perf_counters(__attribute__ ((unused)) const char *const arg)
+{
+  PERF_COUNTERS = 1;
+  return EXIT_SUCCESS;
+}
+
+int select_n_threads(const char *const arg)
+{
+  //
+  const char *ptr = strchr(arg, '=');
+  const uint64_t value = atoll(++ptr);
+  N_THREADS = value;
+
+  if (N_THREADS)
+    omp_set_num_threads(N_THREADS);
+
+  return EXIT_SUCCESS;
+}
+
 //
 static void handle_argument(const int argc, const char **argv)
 {
@@ -98,9 +351,27 @@ static void handle_argument(const int argc, const char **argv)
   //
   addArgument("--version", "-v", print_version, "Display the software version.");
   addArgument("--input=", "-i=", select_input, "Select input file.");
+  // Options are matched by prefix, before --output=
+  addArgument("--output-stride=", NULL, select_output_stride, "Store one step every OUTPUT_STRIDE steps.");
   addArgument("--output=", "-o=", select_output, "Select output file.");
+  addArgument("--checkpoint-stride=", NULL, select_checkpoint_stride, "Write a checkpoint every CHECKPOINT_STRIDE steps.");
+  addArgument("--checkpoint=", NULL, select_checkpoint, "Select checkpoint file.");
+  addArgument("--restart=", NULL, select_restart, "Resume the run from a checkpoint file.");
+  addArgument("--format=", NULL, select_format, "Select output format, pdb, bin or compressed.");
+  addArgument("--resolution=", NULL, select_resolution, "Select the quantum of positions of the compressed format, in angstroms.");
+  addArgument("--engine=", NULL, select_engine, "Select force engine of velocity verlet, periodic or all-pairs.");
+  addArgument("--run=", NULL, select_run, "Select runs, comma separated among lj, plj, vv, drift and ensemble.");
+  addArgument("--precision=", NULL, select_precision, "Select pair kernels precision, double or mixed.");
   addArgument("--nstep=", NULL, select_n_step, "Select N_STEP value.");
+  addArgument("--box=", NULL, select_box, "Select box length L.");
   addArgument("--rcut=", NULL, select_r_cut, "Select R_CUT value.");
+  addArgument("--skin=", NULL, select_skin, "Select neighbour list skin, 0 to disable it.");
+  addArgument("--threads=", "-t=", select_n_threads, "Select the number of threads.");
+  addArgument("--seed=", NULL, select_seed, "Select the seed of the kinetic moments, 0 to take it from the time.");
+  addArgument("--replicas=", NULL, select_replicas, "Select the number of replicas of the ensemble run.");
+  addArgument("--sort-every=", NULL, select_sort_every, "Reorder particles along a Morton curve every SORT_EVERY steps, 0 to disable it.");
+  addArgument("--huge-pages", NULL, select_huge_pages, "Back the state of the runs with transparent huge pages.");
+  addArgument("--perf-counters", NULL, select_perf_counters, "Count hardware events of the force kernels and the integrator.");
 
   //
   parseArguments(argc, argv);
@@ -112,6 +383,9 @@ static void handle_argument(const int argc, const char **argv)
 //
 static void print_column_name(void)
 {
+  if (RANK != 0)
+    return;
+
   printf("              "
          "%14s "
          "%15s "
@@ -135,6 +409,9 @@ static void print_step(const uint64_t step,
                        const double norm_sum_forces)
 {
 #if DEBUG
+  if (RANK != 0)
+    return;
+
   printf("STEP %5ld -- ", step);
   printf("%14e ", temperature);
   printf("%15e ", tot_energy);
@@ -146,16 +423,12 @@ static void print_step(const uint64_t step,
 }
 
 //
-static void run_lennard_jones(void)
+static void run_lennard_jones(const struct particle *restrict p)
 {
   //
   double before;
   double after;
 
-  // Particles
-  struct particle *restrict p = get_particles(INPUT_FILE);
-  //print_particles(p);
-
   // Init lennard jones
   struct lennard_jones *restrict lj = init_lennard_jones();
 
@@ -164,7 +437,9 @@ static void run_lennard_jones(void)
   before = simulation_clock.tv_sec + simulation_clock.tv_nsec * 1.0e-9;
 
   // Run lennard jones
+  perf_counters_start(PERF_LENNARD_JONES);
   lennard_jones(lj, p);
+  perf_counters_stop(PERF_LENNARD_JONES);
 
   // Take time after
   clock_gettime(CLOCK_MONOTONIC, &simulation_clock);
@@ -172,8 +447,9 @@ static void run_lennard_jones(void)
 
   // Print
   printf("== Lennard Jones ==\n");
+  printf("pair kernel: %s, threads: %ld\n", pair_kernel_name(lj->kernel), lj->n_threads);
   print_energy(lj);
-  uint64_t error __attribute__((unused)) = check_forces(lj->f, TOLERANCE);
+  uint64_t error __attribute__((unused)) = check_forces(lj, TOLERANCE);
   printf("Take: %lf seconds\n", after - before);
   printf("\n");
 
@@ -182,29 +458,28 @@ static void run_lennard_jones(void)
 }
 
 //
-static void run_periodical_lennard_jones(void)
+static void run_periodical_lennard_jones(const struct particle *restrict p)
 {
   //
   double before;
   double after;
 
-  // Particles
-  struct particle *restrict p = get_particles(INPUT_FILE);
-  //print_particles(p);
-
   // Generate translation vectors
-  struct translation_vector *restrict tv = init_translation_vectors(N_SYM);
-  //print_translation_vectors(tv, N_SYM);
+  const uint64_t n_tv = n_translation_vectors(R_CUT);
+  struct translation_vector *restrict tv = init_translation_vectors(n_tv);
+  //print_translation_vectors(tv, n_tv);
 
-  // Init lennard jones
-  struct lennard_jones *restrict plj = init_lennard_jones();
+  // Init lennard jones, a neighbour list does not pay off for one evaluation
+  struct lennard_jones *restrict plj = init_periodical_lennard_jones(R_CUT, 0.0);
 
   // Take time before
   clock_gettime(CLOCK_MONOTONIC, &simulation_clock);
   before = simulation_clock.tv_sec + simulation_clock.tv_nsec * 1.0e-9;
 
   // Run periodical lennard jones
-  periodical_lennard_jones(plj, p, tv, R_CUT, N_SYM);
+  perf_counters_start(PERF_PERIODICAL_LENNARD_JONES);
+  periodical_lennard_jones(plj, p, tv, R_CUT, n_tv);
+  perf_counters_stop(PERF_PERIODICAL_LENNARD_JONES);
 
   // Take time after
   clock_gettime(CLOCK_MONOTONIC, &simulation_clock);
@@ -213,7 +488,7 @@ static void run_periodical_lennard_jones(void)
   // Print
   printf("== Periodical Lennard Jones ==\n");
   print_energy(plj);
-  uint64_t plj_error __attribute__((unused)) = check_forces(plj->f, TOLERANCE);
+  uint64_t plj_error __attribute__((unused)) = check_forces(plj, TOLERANCE);
   printf("Take: %lf seconds\n", after - before);
   printf("\n");
 
@@ -222,31 +497,110 @@ static void run_periodical_lennard_jones(void)
   free_translation_vector(tv);
 }
 
-//
-static void run_velocity_verlet(void)
+// Store every particle, gathered on the first process, every OUTPUT_STRIDE
+// steps. The trajectory writes them in the background
+static void store_step(struct trajectory *restrict traj,
+                       __attribute__ ((unused)) struct lennard_jones *restrict plj,
+                       const struct particle *restrict p,
+                       __attribute__ ((unused)) struct particle *restrict all,
+                       const uint64_t *restrict id,
+                       const uint64_t step)
 {
-  //
-  reset_file(OUTPUT_FILE);
+  if (step % OUTPUT_STRIDE)
+    return;
+
+#if MPI
+  gather_particles(plj->dd, p, all);
+  p = all;
+#endif
 
+  if (traj)
+    store_particles(traj, p, id, step);
+}
+
+//
+static void run_velocity_verlet(const struct particle *restrict p0)
+{
   //
   double before;
   double after;
 
-  // Particles
-  struct particle *restrict p = get_particles(INPUT_FILE);
-  //print_particles(p);
+#if MPI
+  if (strcmp(CHECKPOINT_FILE, "") != 0 || strcmp(RESTART_FILE, "") != 0)
+    {
+      if (RANK == 0)
+        printf("Error: checkpoints are not supported with MPI\n");
+
+      exit(ERR_USAGE);
+    }
+
+  // The domains hold particles in their own order
+  if (SORT_EVERY)
+    {
+      if (RANK == 0)
+        printf("Error: reordering particles is not supported with MPI\n");
+
+      exit(ERR_USAGE);
+    }
+#endif
+
+  // Particles, moved by the integrator
+  struct particle *restrict p = init_particles(N_PARTICLES_TOTAL);
+  copy_particles(p, p0, N_PARTICLES_TOTAL);
 
   // Generate translation vectors
-  struct translation_vector *restrict tv = init_translation_vectors(N_SYM);
+  const uint64_t n_tv = n_translation_vectors(R_CUT);
+  struct translation_vector *restrict tv = init_translation_vectors(n_tv);
 
   // Init lennard jones
-  struct lennard_jones *restrict plj = init_lennard_jones();
+  struct lennard_jones *restrict plj = init_force_engine(FORCE_ENGINE, R_CUT, SKIN);
+
+#if MPI
+  struct particle *restrict all = init_particles(N_PARTICLES_TOTAL);
+  struct reorder *restrict r = NULL;
+#else
+  struct particle *restrict all = NULL;
+  struct reorder *restrict r = init_reorder();
+#endif
 
   // Velocity verlet
-  printf("\n== Velocity Verlet ==\n");
+  if (RANK == 0)
+    {
+      printf("\n== Velocity Verlet ==\n");
+      printf("engine: %s\n", FORCE_ENGINE->name);
+    }
 
-  struct kinetic_moment *restrict km = init_velocity_verlet();
-  periodical_lennard_jones(plj, p, tv, R_CUT, N_SYM);
+  // Initial state, or the state of a checkpoint
+  struct kinetic_moment *restrict km = NULL;
+  uint64_t first = 1;
+  uint64_t offset = 0;
+  double thermostat = 0.0;
+
+  if (strcmp(RESTART_FILE, "") != 0)
+    {
+      km = init_kinetic_moment();
+      first = read_checkpoint(RESTART_FILE, &thermostat, p, km, plj, r ? r->id : NULL,
+                              OUTPUT_FORMAT, RESOLUTION, &offset) + 1;
+    }
+  else
+    km = init_velocity_verlet();
+
+  // Given with --seed= to draw the same kinetic moments again
+  if (RANK == 0)
+    printf("seed: %ld\n", SEED);
+
+  // Trajectory, written by the first process
+  struct trajectory *restrict traj =
+    RANK == 0 ? open_trajectory(OUTPUT_FILE, OUTPUT_FORMAT, RESOLUTION, offset) : NULL;
+
+#if MPI
+  // Every process generated the same kinetic moments for every particle
+  scatter_particles(plj->dd, p, km);
+
+  if (RANK == 0)
+    printf("domain: %d processes, %d x %d x %d subdomains\n", plj->dd->n_ranks,
+           plj->dd->dims[0], plj->dd->dims[1], plj->dd->dims[2]);
+#endif
 
   //
   print_column_name();
@@ -254,36 +608,68 @@ static void run_velocity_verlet(void)
   //
   struct ket *restrict ket = init_ket();
 
-  // Step 0
-  compute_kinetic_energy_and_temperature(ket, km);
-  print_step(0, ket->temperature, ket->kinetic_energy + plj->energy,
-             ket->kinetic_energy, plj->energy,
-             norm_3d(plj->sum->fx, plj->sum->fz, plj->sum->fz));
-  store_particles(OUTPUT_FILE, p, 0);
+  // Step 0, with the only force evaluation outside of the steps
+  if (first == 1)
+    {
+      compute_forces(p, tv, plj, R_CUT);
+
+      compute_kinetic_energy_and_temperature(ket, km);
+      print_step(0, ket->temperature, ket->kinetic_energy + plj->energy,
+                 ket->kinetic_energy, plj->energy,
+                 norm_3d(plj->sum->fx, plj->sum->fz, plj->sum->fz));
+      store_step(traj, plj, p, all, r ? r->id : NULL, 0);
+    }
+  else
+    printf("Restart after step %ld\n", first - 1);
 
   // Take time before
   clock_gettime(CLOCK_MONOTONIC, &simulation_clock);
   before = simulation_clock.tv_sec + simulation_clock.tv_nsec * 1.0e-9;
 
+#if TIMERS
+  init_timers(N_STEP + 1 - first);
+#endif
+
   // Launch velocity verlet
-  for (uint64_t step = 1; step < N_STEP + 1; step++)
+  for (uint64_t step = first; step < N_STEP + 1; step++)
     {
-      //
-      velocity_verlet(p, tv, plj, km, R_CUT);
+      // Particles close in space are close in memory for the steps to come
+      if (SORT_EVERY && (step - 1) % SORT_EVERY == 0)
+        {
+          TIMER_START(TIMER_REORDER);
+          reorder_particles(r, p, km, plj);
+          TIMER_STOP(TIMER_REORDER);
+        }
 
       //
-      compute_kinetic_energy_and_temperature(ket, km);
+      velocity_verlet(p, tv, plj, km, ket, R_CUT, thermostat);
+
+      TIMER_START(TIMER_IO);
 
       print_step(step, ket->temperature, ket->kinetic_energy + plj->energy,
                  ket->kinetic_energy, plj->energy,
                  norm_3d(plj->sum->fx, plj->sum->fz, plj->sum->fz));
 
       //
-      store_particles(OUTPUT_FILE, p, step);
+      store_step(traj, plj, p, all, r ? r->id : NULL, step);
 
-      //
-      if (step % M_STEP == 0)
-        berendsen_thermostat(km, ket);
+      TIMER_STOP(TIMER_IO);
+
+      // Applied with the first kick of the next step
+      TIMER_START(TIMER_THERMOSTAT);
+      thermostat = step % M_STEP == 0 ? berendsen_thermostat(ket) : 0.0;
+      TIMER_STOP(TIMER_THERMOSTAT);
+
+      // Checkpoint, once the step is complete
+      TIMER_START(TIMER_IO);
+
+      if (strcmp(CHECKPOINT_FILE, "") != 0 &&
+          (step % CHECKPOINT_STRIDE == 0 || step == N_STEP))
+        write_checkpoint(CHECKPOINT_FILE, step, thermostat, p, km, plj, r ? r->id : NULL, traj);
+
+      TIMER_STOP(TIMER_IO);
+
+      TIMER_STEP();
     }
 
   // Take time after
@@ -291,27 +677,325 @@ static void run_velocity_verlet(void)
   after = simulation_clock.tv_sec + simulation_clock.tv_nsec * 1.0e-9;
 
   // Print
-  printf("\n");
-  printf("Simulate: %lf fento-seconds\n", (double)N_STEP * DT);
-  printf("Take: %lf seconds\n", after - before);
-  printf("\n");
+  if (RANK == 0)
+    {
+      printf("\n");
+      printf("Simulate: %lf fento-seconds\n", (double)N_STEP * DT);
+      printf("Take: %lf seconds\n", after - before);
+
+      if (plj->nl)
+        print_neighbour_list(plj->nl);
+
+      if (r && r->n_sort)
+        printf("Reorder: %ld sorts along a Morton curve\n", r->n_sort);
+
+      printf("\n");
+
+#if TIMERS
+      print_timers();
+#endif
+    }
+
+#if TIMERS
+  free_timers();
+#endif
 
   // Release memory
+  if (traj)
+    close_trajectory(traj);
+
+  if (all)
+    free_particles(all);
+
+  if (r)
+    free_reorder(r);
+
   free_ket(ket);
   free_kinetic_moment(km);
-  free_lennard_jones(plj);
+  FORCE_ENGINE->free(plj);
   free_particles(p);
 }
 
+// Velocity verlet from the same state with the double and the mixed
+// precision pair kernels, compare their total energies over N_STEP steps
+static void run_drift(const struct particle *restrict p0)
+{
+#if MPI
+  if (RANK == 0)
+    printf("Error: drift report is not supported with MPI\n");
+
+  exit(ERR_USAGE);
+#endif
+
+  //
+  const uint64_t n_tv = n_translation_vectors(R_CUT);
+  struct translation_vector *restrict tv = init_translation_vectors(n_tv);
+
+  // One run per precision, from the same kinetic moments
+  struct particle *restrict p[2];
+  struct lennard_jones *restrict plj[2];
+  struct kinetic_moment *restrict km[2];
+  struct ket *restrict ket[2];
+  double thermostat[2] = { 0.0, 0.0 };
+  double take[2] = { 0.0, 0.0 };
+
+  for (uint64_t k = 0; k < 2; k++)
+    {
+      p[k] = init_particles(N_PARTICLES_TOTAL);
+      copy_particles(p[k], p0, N_PARTICLES_TOTAL);
+
+      plj[k] = init_force_engine(FORCE_ENGINE, R_CUT, SKIN);
+      plj[k]->precision = k ? PRECISION_MIXED : PRECISION_DOUBLE;
+      plj[k]->kernel = select_pair_kernel(plj[k]->precision);
+
+      km[k] = init_velocity_verlet();
+      ket[k] = init_ket();
+
+      compute_forces(p[k], tv, plj[k], R_CUT);
+      compute_kinetic_energy_and_temperature(ket[k], km[k]);
+    }
+
+  printf("\n== Precision drift ==\n");
+  printf("engine: %s, pair kernels: %s and %s\n", FORCE_ENGINE->name,
+         pair_kernel_name(plj[0]->kernel), pair_kernel_name(plj[1]->kernel));
+  printf("              %15s %15s %15s\n", "DOUBLE", "MIXED", "DIFFERENCE");
+
+  // Difference of total energies, and least squares fit of the total
+  // energy of each run against the step
+  double max_diff = 0.0;
+  double sum_diff_2 = 0.0;
+  double sum_s = 0.0;
+  double sum_s_2 = 0.0;
+  double sum_e[2] = { 0.0, 0.0 };
+  double sum_se[2] = { 0.0, 0.0 };
+  const uint64_t every = N_STEP < 10 ? 1 : N_STEP / 10;
+
+  for (uint64_t step = 0; step < N_STEP + 1; step++)
+    {
+      double e[2];
+
+      for (uint64_t k = 0; k < 2; k++)
+        {
+          if (step)
+            {
+              clock_gettime(CLOCK_MONOTONIC, &simulation_clock);
+              const double before = simulation_clock.tv_sec + simulation_clock.tv_nsec * 1.0e-9;
+
+              velocity_verlet(p[k], tv, plj[k], km[k], ket[k], R_CUT, thermostat[k]);
+
+              clock_gettime(CLOCK_MONOTONIC, &simulation_clock);
+              take[k] += simulation_clock.tv_sec + simulation_clock.tv_nsec * 1.0e-9 - before;
+
+              thermostat[k] = step % M_STEP == 0 ? berendsen_thermostat(ket[k]) : 0.0;
+            }
+
+          e[k] = ket[k]->kinetic_energy + plj[k]->energy;
+          sum_e[k] += e[k];
+          sum_se[k] += step * e[k];
+        }
+
+      const double diff = e[1] - e[0];
+
+      if (abs_double(diff) > max_diff)
+        max_diff = abs_double(diff);
+
+      sum_diff_2 += square(diff);
+      sum_s += step;
+      sum_s_2 += square((double)step);
+
+      if (step % every == 0 || step == N_STEP)
+        printf("STEP %5ld -- %15e %15e %15e\n", step, e[0], e[1], diff);
+    }
+
+  const double n = N_STEP + 1;
+  const double var_s = sum_s_2 - square(sum_s) / n;
+
+  printf("\n");
+  printf("Difference of total energy: max %e, rms %e\n",
+         max_diff, sqrt(sum_diff_2 / n));
+
+  if (var_s > 0.0)
+    printf("Drift of total energy per step: double %e, mixed %e\n",
+           (sum_se[0] - sum_s * sum_e[0] / n) / var_s,
+           (sum_se[1] - sum_s * sum_e[1] / n) / var_s);
+
+  printf("Take: double %lf seconds, mixed %lf seconds\n", take[0], take[1]);
+  printf("\n");
+
+  // Release memory
+  for (uint64_t k = 0; k < 2; k++)
+    {
+      free_ket(ket[k]);
+      free_kinetic_moment(km[k]);
+      FORCE_ENGINE->free(plj[k]);
+      free_particles(p[k]);
+    }
+
+  free_translation_vector(tv);
+}
+
+// N_REPLICAS runs of velocity verlet from the same positions with their own
+// kinetic moments, advanced together in one process
+static void run_ensemble(const struct particle *restrict p0)
+{
+#if MPI
+  if (RANK == 0)
+    printf("Error: ensemble run is not supported with MPI\n");
+
+  exit(ERR_USAGE);
+#endif
+
+  //
+  double before;
+  double after;
+
+  struct ensemble *restrict e =
+    init_ensemble(p0, N_REPLICAS, FORCE_ENGINE, R_CUT, SKIN);
+
+  printf("\n== Ensemble ==\n");
+  printf("engine: %s, replicas: %ld, threads: %ld, seed: %ld\n",
+         FORCE_ENGINE->name, e->n_replicas, e->n_threads, SEED);
+  printf("              %14s %15s %15s\n",
+         "TEMPERATURE", "TOTAL_ENERGY", "STD_ENERGY");
+
+  // Mean over the replicas
+  struct ket mean;
+  double energy;
+  double std_energy;
+
+  ensemble_forces(e, R_CUT);
+  ensemble_mean(e, &mean, &energy, &std_energy);
+  printf("STEP %5d -- %14e %15e %15e\n", 0, mean.temperature, energy, std_energy);
+
+  // Take time before
+  clock_gettime(CLOCK_MONOTONIC, &simulation_clock);
+  before = simulation_clock.tv_sec + simulation_clock.tv_nsec * 1.0e-9;
+
+  const uint64_t every = N_STEP < 10 ? 1 : N_STEP / 10;
+
+  for (uint64_t step = 1; step < N_STEP + 1; step++)
+    {
+      ensemble_step(e, R_CUT, step % M_STEP == 0);
+
+      if (step % every == 0 || step == N_STEP)
+        {
+          ensemble_mean(e, &mean, &energy, &std_energy);
+          printf("STEP %5ld -- %14e %15e %15e\n", step, mean.temperature,
+                 energy, std_energy);
+        }
+    }
+
+  // Take time after
+  clock_gettime(CLOCK_MONOTONIC, &simulation_clock);
+  after = simulation_clock.tv_sec + simulation_clock.tv_nsec * 1.0e-9;
+
+  // Print
+  printf("\n");
+  printf("Simulate: %ld x %lf fento-seconds\n", e->n_replicas, (double)N_STEP * DT);
+  printf("Take: %lf seconds, %lf replica steps per second\n", after - before,
+         (double)(e->n_replicas * N_STEP) / (after - before));
+  printf("\n");
+
+  // Release memory
+  free_ensemble(e);
+}
+
+// Bytes of the state of a run, with room to spare as the arena is committed
+// as it is touched: a few dozen arrays of N_PARTICLES_TOTAL positions, one
+// force buffer per thread, for each replica of an ensemble
+static uint64_t arena_size(void)
+{
+  const uint64_t n_threads = omp_get_max_threads();
+  const uint64_t vector = sizeof(double) * 3 * N_PARTICLES_TOTAL;
+
+  uint64_t size = vector * (32 + n_threads);
+
+  if (RUN & RUN_ENSEMBLE && vector * N_REPLICAS * (16 + 1) > size)
+    size = vector * N_REPLICAS * (16 + 1);
+
+#if FORCE_MATRIX
+  size += sizeof(struct force) * N_PARTICLES_TOTAL * N_PARTICLES_TOTAL;
+#endif
+
+  return size + (1 << 20);
+}
+
 int main(int argc, char **argv)
 {
+#if MPI
+  // Only the master thread calls MPI
+  int provided;
+  int rank;
+
+  MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  RANK = rank;
+#endif
+
   // Handle command line argument
   handle_argument(argc, argv);
 
-  // Run
-  run_lennard_jones();
-  run_periodical_lennard_jones();
-  run_velocity_verlet();
+  if (!FORCE_ENGINE)
+    FORCE_ENGINE = find_force_engine("periodic");
+
+  // Before any thread is created, to count the events of every thread
+  if (PERF_COUNTERS)
+    init_perf_counters();
+
+  // Particles, loaded once for every run
+  struct particle *restrict p = get_particles(INPUT_FILE);
+  //print_particles(p);
+
+  // State of every run, released at once when the run ends
+  init_arena(arena_size(), HUGE_PAGES);
+
+  const uint64_t mark = arena_mark();
+
+  // Run, single evaluations are not distributed
+  if (RANK == 0 && RUN & RUN_LENNARD_JONES)
+    {
+      run_lennard_jones(p);
+      arena_release(mark);
+    }
+
+  if (RANK == 0 && RUN & RUN_PERIODICAL_LENNARD_JONES)
+    {
+      run_periodical_lennard_jones(p);
+      arena_release(mark);
+    }
+
+  if (RUN & RUN_VELOCITY_VERLET)
+    {
+      run_velocity_verlet(p);
+      arena_release(mark);
+    }
+
+  if (RUN & RUN_DRIFT)
+    {
+      run_drift(p);
+      arena_release(mark);
+    }
+
+  if (RUN & RUN_ENSEMBLE)
+    {
+      run_ensemble(p);
+      arena_release(mark);
+    }
+
+  if (RANK == 0)
+    {
+      print_perf_counters();
+      print_arena();
+    }
+
+  // Release memory
+  free_perf_counters();
+  free_particles(p);
+  free_arena();
+
+#if MPI
+  MPI_Finalize();
+#endif
 
   return 0;
 }
@@ -0,0 +1,229 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "helper.h"
+#include "common.h"
+#include "arena.h"
+#include "cell_list.h"
+#include "neighbour_list.h"
+
+struct neighbour_list *init_neighbour_list(const double r_cut,
+                                           const double skin)
+{
+  if (skin <= 0.0)
+    return NULL;
+
+  // Candidates are searched in cells of side r_cut + skin
+  struct cell_list *restrict cl = init_cell_list(r_cut + skin);
+
+  if (!cl)
+    return NULL;
+
+  // Allocate memory
+  struct neighbour_list *restrict nl =
+    arena_alloc(sizeof(struct neighbour_list));
+
+  nl->r_cut = r_cut;
+  nl->skin = skin;
+  nl->capacity = 0;
+  nl->start = arena_alloc(sizeof(uint64_t) * (N_PARTICLES_LOCAL + 1));
+  nl->j = NULL;
+  nl->image = NULL;
+  nl->p0 = init_particles(N_PARTICLES_LOCAL);
+  nl->cl = cl;
+
+  nl->n_build = 0;
+  nl->n_update = 0;
+  nl->n_pairs = 0;
+
+  return nl;
+}
+
+void free_neighbour_list(struct neighbour_list *restrict nl)
+{
+  free_cell_list(nl->cl);
+  arena_free(nl->start);
+  free(nl->j);
+  free(nl->image);
+  free_particles(nl->p0);
+  arena_free(nl);
+}
+
+// Visit every pair i < j closer than r_cut + skin, fill the list when fill is
+// set. Cells are shared among threads, each particle is only written by the
+// thread owning its cell
+static void visit_pairs(struct neighbour_list *restrict nl,
+                        const struct particle *restrict p,
+                        const uint64_t fill)
+{
+  const struct cell_list *restrict cl = nl->cl;
+  const int64_t n_cells = (int64_t)cl->n_cells;
+  const double r_list_2 = square(nl->r_cut + nl->skin);
+
+#pragma omp parallel for schedule(static)
+  for (int64_t c = 0; c < cube(n_cells); c++)
+    {
+      const int64_t cx = c / square(n_cells);
+      const int64_t cy = (c / n_cells) % n_cells;
+      const int64_t cz = c % n_cells;
+
+      // Neighbouring cells, wrapped with the matching translation
+      for (int64_t o = 0; o < 27; o++)
+        {
+          const int64_t nx = cx + o / 9 - 1;
+          const int64_t ny = cy + (o / 3) % 3 - 1;
+          const int64_t nz = cz + o % 3 - 1;
+
+          const struct translation_vector tv =
+            {
+              .x = nx < 0 ? -L : (nx >= n_cells ? L : 0.0),
+              .y = ny < 0 ? -L : (ny >= n_cells ? L : 0.0),
+              .z = nz < 0 ? -L : (nz >= n_cells ? L : 0.0)
+            };
+
+          const uint64_t nc =
+            cell_id(cl,
+                    (nx + n_cells) % n_cells,
+                    (ny + n_cells) % n_cells,
+                    (nz + n_cells) % n_cells);
+
+          for (uint64_t a = cl->cell_start[c]; a < cl->cell_start[c + 1]; a++)
+            {
+              const uint64_t i = cl->index[a];
+
+              for (uint64_t b = cl->cell_start[nc]; b < cl->cell_start[nc + 1]; b++)
+                {
+                  const uint64_t j = cl->index[b];
+
+                  // Keep each pair once
+                  if (j <= i)
+                    continue;
+
+                  const struct translation_vector d =
+                    {
+                      .x = cl->w->x[a] - cl->w->x[b] - tv.x,
+                      .y = cl->w->y[a] - cl->w->y[b] - tv.y,
+                      .z = cl->w->z[a] - cl->w->z[b] - tv.z
+                    };
+
+                  if (square(d.x) + square(d.y) + square(d.z) > r_list_2)
+                    continue;
+
+                  if (!fill)
+                    {
+                      nl->start[i + 1]++;
+                      continue;
+                    }
+
+                  // Image of j, in box lengths, seen from unwrapped positions
+                  const uint64_t k = nl->start[i]++;
+
+                  nl->j[k] = (uint32_t)j;
+                  nl->image[3 * k + 0] = (int8_t)lround((d.x - (p->x[i] - p->x[j])) / L);
+                  nl->image[3 * k + 1] = (int8_t)lround((d.y - (p->y[i] - p->y[j])) / L);
+                  nl->image[3 * k + 2] = (int8_t)lround((d.z - (p->z[i] - p->z[j])) / L);
+                }
+            }
+        }
+    }
+}
+
+static uint64_t fill_neighbour_list(struct neighbour_list *restrict nl,
+                                    const struct particle *restrict p)
+{
+  build_cell_list(nl->cl, p);
+
+  // Count neighbours of each particle
+  for (uint64_t i = 0; i < N_PARTICLES_LOCAL + 1; i++)
+    nl->start[i] = 0;
+
+  visit_pairs(nl, p, 0);
+
+  for (uint64_t i = 0; i < N_PARTICLES_LOCAL; i++)
+    nl->start[i + 1] += nl->start[i];
+
+  const uint64_t n_pairs = nl->start[N_PARTICLES_LOCAL];
+
+  // Grow the list if needed
+  if (n_pairs > nl->capacity)
+    {
+      nl->capacity = n_pairs + n_pairs / 4;
+
+      free(nl->j);
+      free(nl->image);
+
+      nl->j = aligned_alloc(ALIGN, sizeof(uint32_t) * nl->capacity);
+      nl->image = aligned_alloc(ALIGN, sizeof(int8_t) * 3 * nl->capacity);
+    }
+
+  // Fill, the start of each particle is used as cursor
+  visit_pairs(nl, p, 1);
+
+  for (uint64_t i = N_PARTICLES_LOCAL; i > 0; i--)
+    nl->start[i] = nl->start[i - 1];
+
+  nl->start[0] = 0;
+
+  return n_pairs;
+}
+
+static void build_neighbour_list(struct neighbour_list *restrict nl,
+                                 const struct particle *restrict p)
+{
+  const uint64_t n_pairs = fill_neighbour_list(nl, p);
+
+  // Save reference positions
+  copy_particles(nl->p0, p, N_PARTICLES_LOCAL);
+
+  nl->n_build++;
+  nl->n_pairs += n_pairs;
+}
+
+void update_neighbour_list(struct neighbour_list *restrict nl,
+                           const struct particle *restrict p)
+{
+  nl->n_update++;
+
+  // Maximum displacement since last build
+  double max_2 = 0.0;
+
+  if (nl->n_build == 0)
+    max_2 = INFINITY;
+  else
+    for (uint64_t i = 0; i < N_PARTICLES_LOCAL; i++)
+      {
+        const double d_2 =
+          square(p->x[i] - nl->p0->x[i])
+          + square(p->y[i] - nl->p0->y[i])
+          + square(p->z[i] - nl->p0->z[i]);
+
+        max_2 = d_2 > max_2 ? d_2 : max_2;
+      }
+
+  if (max_2 > square(0.5 * nl->skin))
+    build_neighbour_list(nl, p);
+}
+
+void restart_neighbour_list(struct neighbour_list *restrict nl,
+                            const struct particle *restrict p0)
+{
+  build_neighbour_list(nl, p0);
+}
+
+void reorder_neighbour_list(struct neighbour_list *restrict nl)
+{
+  // Same pairs as the last build from the reordered reference positions, not
+  // counted again
+  fill_neighbour_list(nl, nl->p0);
+}
+
+void print_neighbour_list(const struct neighbour_list *restrict nl)
+{
+  const double mean =
+    nl->n_build ? 2.0 * nl->n_pairs / ((double)nl->n_build * N_PARTICLES_LOCAL) : 0.0;
+
+  printf("Neighbour list: skin %lf, %ld rebuilds for %ld force evaluations, "
+         "%lf neighbours per particle\n",
+         nl->skin, nl->n_build, nl->n_update, mean);
+}
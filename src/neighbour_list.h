@@ -0,0 +1,25 @@
+#ifndef _NEIGHBOUR_LIST_H_
+#define _NEIGHBOUR_LIST_H_
+
+// Return NULL when skin is not positive or the box is too small for r_cut + skin
+struct neighbour_list *init_neighbour_list(const double r_cut,
+                                           const double skin);
+
+//
+void free_neighbour_list(struct neighbour_list *restrict nl);
+
+// Rebuild the list when a particle moved more than skin / 2 since the last build
+void update_neighbour_list(struct neighbour_list *restrict nl,
+                           const struct particle *restrict p);
+
+// Build the list from the positions p0 of its last build, when resuming a run
+void restart_neighbour_list(struct neighbour_list *restrict nl,
+                            const struct particle *restrict p0);
+
+// Build the list again from p0, after the particles were reordered
+void reorder_neighbour_list(struct neighbour_list *restrict nl);
+
+//
+void print_neighbour_list(const struct neighbour_list *restrict nl);
+
+#endif // _NEIGHBOUR_LIST_H_
@@ -0,0 +1,562 @@
+#include <math.h>
+#include <immintrin.h>
+
+#include "helper.h"
+#include "pair_kernel.h"
+
+pair_kernel select_pair_kernel(__attribute__ ((unused)) const uint64_t precision)
+{
+#if FORCE_MATRIX
+  // Only the scalar kernel fills the matrix
+  return pair_kernel_scalar;
+#else
+  __builtin_cpu_init();
+
+  const uint64_t mixed = precision == PRECISION_MIXED;
+
+  if (__builtin_cpu_supports("avx512f"))
+    return mixed ? pair_kernel_avx512_mixed : pair_kernel_avx512;
+
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+    return mixed ? pair_kernel_avx2_mixed : pair_kernel_avx2;
+
+  return mixed ? pair_kernel_scalar_mixed : pair_kernel_scalar;
+#endif
+}
+
+const char *pair_kernel_name(const pair_kernel kernel)
+{
+  if (kernel == pair_kernel_avx512)
+    return "avx512";
+
+  if (kernel == pair_kernel_avx512_mixed)
+    return "avx512-mixed";
+
+  if (kernel == pair_kernel_avx2)
+    return "avx2";
+
+  if (kernel == pair_kernel_avx2_mixed)
+    return "avx2-mixed";
+
+  if (kernel == pair_kernel_scalar_mixed)
+    return "scalar-mixed";
+
+  return "scalar";
+}
+
+// Particle j k seen from i in d, returns the square distance
+static inline double distance_scalar(const struct pair_row *restrict row,
+                                     const uint64_t k,
+                                     struct translation_vector *restrict d)
+{
+  d->x = row->xi - row->x[k];
+  d->y = row->yi - row->y[k];
+  d->z = row->zi - row->z[k];
+
+  if (row->wrap)
+    {
+      d->x = minimum_image(d->x);
+      d->y = minimum_image(d->y);
+      d->z = minimum_image(d->z);
+    }
+
+  d->x -= row->tv.x;
+  d->y -= row->tv.y;
+  d->z -= row->tv.z;
+
+  return square(d->x) + square(d->y) + square(d->z);
+}
+
+// Force of the pair of particle j k, from du_ij
+static inline void force_scalar(const struct pair_row *restrict row,
+                                const uint64_t k, const double du_ij,
+                                const struct translation_vector *restrict d,
+                                struct force *restrict f_i)
+{
+  // Force on particle i with j
+  const struct force f_ij =
+    {
+      .fx = du_ij * d->x,
+      .fy = du_ij * d->y,
+      .fz = du_ij * d->z
+    };
+
+#if FORCE_MATRIX
+  const uint64_t i = row->i;
+  const uint64_t j = row->index ? row->index[k] : row->j + k;
+
+  // Update force on particle i with j
+  row->f[i][j].fx += f_ij.fx;
+  row->f[i][j].fy += f_ij.fy;
+  row->f[i][j].fz += f_ij.fz;
+
+  // Update force on particle j with i
+  row->f[j][i].fx -= f_ij.fx;
+  row->f[j][i].fy -= f_ij.fy;
+  row->f[j][i].fz -= f_ij.fz;
+#endif
+
+  // Update sum
+  f_i->fx += f_ij.fx;
+  f_i->fy += f_ij.fy;
+  f_i->fz += f_ij.fz;
+
+  row->fx[k] -= f_ij.fx;
+  row->fy[k] -= f_ij.fy;
+  row->fz[k] -= f_ij.fz;
+}
+
+void pair_kernel_scalar(const struct pair_row *restrict row,
+                        struct force *restrict f_i,
+                        double *restrict energy)
+{
+  for (uint64_t k = 0; k < row->n; k++)
+    {
+      // Particle j seen from i
+      struct translation_vector d;
+      const double distance = distance_scalar(row, k, &d);
+
+      // Test if the distance is under r_cut and then ignore this step
+      if (distance > row->r_cut_2)
+        continue;
+
+      const double R_STAR_distance = square(R_STAR) / distance;
+
+      const double u_ij =
+        (hexa(R_STAR_distance) - 2.0 * cube(R_STAR_distance));
+
+      // Update energy
+      *energy += u_ij;
+
+      // Update forces
+      const double du_ij =
+        -48.0 * EPSILON_STAR * (septa(R_STAR_distance) - quad(R_STAR_distance));
+
+      force_scalar(row, k, du_ij, &d, f_i);
+    }
+}
+
+// Same as pair_kernel_scalar, with the powers of the distance in single
+// precision. Distances, forces and energy stay in double precision
+void pair_kernel_scalar_mixed(const struct pair_row *restrict row,
+                              struct force *restrict f_i,
+                              double *restrict energy)
+{
+  for (uint64_t k = 0; k < row->n; k++)
+    {
+      // Particle j seen from i
+      struct translation_vector d;
+      const double distance = distance_scalar(row, k, &d);
+
+      // Test if the distance is under r_cut and then ignore this step
+      if (distance > row->r_cut_2)
+        continue;
+
+      const float R_STAR_distance = (float)square(R_STAR) / (float)distance;
+
+      const float u_ij =
+        (hexa(R_STAR_distance) - 2.0f * cube(R_STAR_distance));
+
+      // Update energy
+      *energy += u_ij;
+
+      // Update forces
+      const double du_ij =
+        -48.0f * (float)EPSILON_STAR * (septa(R_STAR_distance) - quad(R_STAR_distance));
+
+      force_scalar(row, k, du_ij, &d, f_i);
+    }
+}
+
+// Horizontal sum of 4 doubles
+__attribute__ ((target("avx2,fma")))
+static inline double sum_avx2(const __m256d v)
+{
+  const __m128d h = _mm_add_pd(_mm256_castpd256_pd128(v),
+                               _mm256_extractf128_pd(v, 1));
+
+  return _mm_cvtsd_f64(_mm_add_sd(h, _mm_unpackhi_pd(h, h)));
+}
+
+// Constants of a row, broadcast once
+struct row_avx2
+{
+  __m256d xi, yi, zi;
+  __m256d tx, ty, tz;
+  __m256d box, inv_box, r_cut_2;
+};
+
+__attribute__ ((target("avx2,fma")))
+static inline struct row_avx2 init_row_avx2(const struct pair_row *restrict row)
+{
+  return (struct row_avx2)
+    {
+      .xi = _mm256_set1_pd(row->xi),
+      .yi = _mm256_set1_pd(row->yi),
+      .zi = _mm256_set1_pd(row->zi),
+      .tx = _mm256_set1_pd(row->tv.x),
+      .ty = _mm256_set1_pd(row->tv.y),
+      .tz = _mm256_set1_pd(row->tv.z),
+      .box = _mm256_set1_pd(L),
+      .inv_box = _mm256_set1_pd(1.0 / L),
+      .r_cut_2 = _mm256_set1_pd(row->r_cut_2)
+    };
+}
+
+// Particles j k to k + 3 seen from i, with their lanes inside the row in
+// valid and their pairs under r_cut in mask. Returns the square distances,
+// harmless outside of mask
+__attribute__ ((target("avx2,fma")))
+static inline __m256d distance_avx2(const struct pair_row *restrict row,
+                                    const struct row_avx2 *restrict c,
+                                    const uint64_t k,
+                                    __m256i *restrict valid,
+                                    __m256d *restrict mask,
+                                    __m256d *restrict dx,
+                                    __m256d *restrict dy,
+                                    __m256d *restrict dz)
+{
+  const uint64_t left = k < row->n ? row->n - k : 0;
+
+  *valid = _mm256_cmpgt_epi64(_mm256_set1_epi64x((int64_t)left),
+                              _mm256_set_epi64x(3, 2, 1, 0));
+
+  *dx = _mm256_sub_pd(c->xi, _mm256_maskload_pd(row->x + k, *valid));
+  *dy = _mm256_sub_pd(c->yi, _mm256_maskload_pd(row->y + k, *valid));
+  *dz = _mm256_sub_pd(c->zi, _mm256_maskload_pd(row->z + k, *valid));
+
+  if (row->wrap)
+    {
+      const int round = _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC;
+
+      *dx = _mm256_fnmadd_pd(c->box, _mm256_round_pd(_mm256_mul_pd(*dx, c->inv_box), round), *dx);
+      *dy = _mm256_fnmadd_pd(c->box, _mm256_round_pd(_mm256_mul_pd(*dy, c->inv_box), round), *dy);
+      *dz = _mm256_fnmadd_pd(c->box, _mm256_round_pd(_mm256_mul_pd(*dz, c->inv_box), round), *dz);
+    }
+
+  *dx = _mm256_sub_pd(*dx, c->tx);
+  *dy = _mm256_sub_pd(*dy, c->ty);
+  *dz = _mm256_sub_pd(*dz, c->tz);
+
+  __m256d distance = _mm256_mul_pd(*dx, *dx);
+  distance = _mm256_fmadd_pd(*dy, *dy, distance);
+  distance = _mm256_fmadd_pd(*dz, *dz, distance);
+
+  *mask = _mm256_and_pd(_mm256_cmp_pd(distance, c->r_cut_2, _CMP_LE_OQ),
+                        _mm256_castsi256_pd(*valid));
+
+  return _mm256_blendv_pd(_mm256_set1_pd(1.0), distance, *mask);
+}
+
+// Forces of the pairs of particles j k to k + 3, from du_ij
+__attribute__ ((target("avx2,fma")))
+static inline void forces_avx2(const struct pair_row *restrict row,
+                               const uint64_t k, const __m256i valid,
+                               const __m256d du_ij, const __m256d dx,
+                               const __m256d dy, const __m256d dz,
+                               __m256d *restrict sfx, __m256d *restrict sfy,
+                               __m256d *restrict sfz)
+{
+  const __m256d fx = _mm256_mul_pd(du_ij, dx);
+  const __m256d fy = _mm256_mul_pd(du_ij, dy);
+  const __m256d fz = _mm256_mul_pd(du_ij, dz);
+
+  *sfx = _mm256_add_pd(*sfx, fx);
+  *sfy = _mm256_add_pd(*sfy, fy);
+  *sfz = _mm256_add_pd(*sfz, fz);
+
+  // Forces on particles j
+  _mm256_maskstore_pd(row->fx + k, valid,
+                      _mm256_sub_pd(_mm256_maskload_pd(row->fx + k, valid), fx));
+  _mm256_maskstore_pd(row->fy + k, valid,
+                      _mm256_sub_pd(_mm256_maskload_pd(row->fy + k, valid), fy));
+  _mm256_maskstore_pd(row->fz + k, valid,
+                      _mm256_sub_pd(_mm256_maskload_pd(row->fz + k, valid), fz));
+}
+
+// 4 particles j per iteration, the cutoff and the tail are handled with masks
+__attribute__ ((target("avx2,fma")))
+void pair_kernel_avx2(const struct pair_row *restrict row,
+                      struct force *restrict f_i,
+                      double *restrict energy)
+{
+  const __m256d r_star_2 = _mm256_set1_pd(square(R_STAR));
+  const __m256d two = _mm256_set1_pd(2.0);
+  const __m256d c_du = _mm256_set1_pd(-48.0 * EPSILON_STAR);
+
+  const struct row_avx2 c = init_row_avx2(row);
+
+  __m256d e = _mm256_setzero_pd();
+  __m256d sfx = _mm256_setzero_pd();
+  __m256d sfy = _mm256_setzero_pd();
+  __m256d sfz = _mm256_setzero_pd();
+
+  for (uint64_t k = 0; k < row->n; k += 4)
+    {
+      __m256i valid;
+      __m256d mask, dx, dy, dz;
+
+      const __m256d distance =
+        distance_avx2(row, &c, k, &valid, &mask, &dx, &dy, &dz);
+
+      const __m256d r = _mm256_div_pd(r_star_2, distance);
+      const __m256d r_2 = _mm256_mul_pd(r, r);
+      const __m256d r_3 = _mm256_mul_pd(r_2, r);
+      const __m256d r_4 = _mm256_mul_pd(r_2, r_2);
+      const __m256d r_6 = _mm256_mul_pd(r_3, r_3);
+      const __m256d r_7 = _mm256_mul_pd(r_6, r);
+
+      const __m256d u_ij = _mm256_fnmadd_pd(two, r_3, r_6);
+      const __m256d du_ij = _mm256_mul_pd(c_du, _mm256_sub_pd(r_7, r_4));
+
+      // Pairs over r_cut dropped
+      e = _mm256_add_pd(e, _mm256_and_pd(u_ij, mask));
+
+      forces_avx2(row, k, valid, _mm256_and_pd(du_ij, mask),
+                  dx, dy, dz, &sfx, &sfy, &sfz);
+    }
+
+  *energy += sum_avx2(e);
+  f_i->fx += sum_avx2(sfx);
+  f_i->fy += sum_avx2(sfy);
+  f_i->fz += sum_avx2(sfz);
+}
+
+// 4 particles j per iteration, with the powers of the distance of the 4
+// pairs in single precision, on 128 bits
+__attribute__ ((target("avx2,fma")))
+void pair_kernel_avx2_mixed(const struct pair_row *restrict row,
+                            struct force *restrict f_i,
+                            double *restrict energy)
+{
+  const __m128 r_star_2 = _mm_set1_ps(square(R_STAR));
+  const __m128 two = _mm_set1_ps(2.0f);
+  const __m128 c_du = _mm_set1_ps(-48.0f * (float)EPSILON_STAR);
+
+  const struct row_avx2 c = init_row_avx2(row);
+
+  __m256d e = _mm256_setzero_pd();
+  __m256d sfx = _mm256_setzero_pd();
+  __m256d sfy = _mm256_setzero_pd();
+  __m256d sfz = _mm256_setzero_pd();
+
+  for (uint64_t k = 0; k < row->n; k += 4)
+    {
+      __m256i valid;
+      __m256d mask, dx, dy, dz;
+
+      const __m128 distance =
+        _mm256_cvtpd_ps(distance_avx2(row, &c, k, &valid, &mask, &dx, &dy, &dz));
+
+      const __m128 r = _mm_div_ps(r_star_2, distance);
+      const __m128 r_2 = _mm_mul_ps(r, r);
+      const __m128 r_3 = _mm_mul_ps(r_2, r);
+      const __m128 r_4 = _mm_mul_ps(r_2, r_2);
+      const __m128 r_6 = _mm_mul_ps(r_3, r_3);
+      const __m128 r_7 = _mm_mul_ps(r_6, r);
+
+      const __m128 u_ij = _mm_fnmadd_ps(two, r_3, r_6);
+      const __m128 du_ij = _mm_mul_ps(c_du, _mm_sub_ps(r_7, r_4));
+
+      // Back to double precision, pairs over r_cut dropped
+      e = _mm256_add_pd(e, _mm256_and_pd(_mm256_cvtps_pd(u_ij), mask));
+
+      forces_avx2(row, k, valid, _mm256_and_pd(_mm256_cvtps_pd(du_ij), mask),
+                  dx, dy, dz, &sfx, &sfy, &sfz);
+    }
+
+  *energy += sum_avx2(e);
+  f_i->fx += sum_avx2(sfx);
+  f_i->fy += sum_avx2(sfy);
+  f_i->fz += sum_avx2(sfz);
+}
+
+// Constants of a row, broadcast once
+struct row_avx512
+{
+  __m512d xi, yi, zi;
+  __m512d tx, ty, tz;
+  __m512d box, inv_box, r_cut_2;
+};
+
+__attribute__ ((target("avx512f")))
+static inline struct row_avx512 init_row_avx512(const struct pair_row *restrict row)
+{
+  return (struct row_avx512)
+    {
+      .xi = _mm512_set1_pd(row->xi),
+      .yi = _mm512_set1_pd(row->yi),
+      .zi = _mm512_set1_pd(row->zi),
+      .tx = _mm512_set1_pd(row->tv.x),
+      .ty = _mm512_set1_pd(row->tv.y),
+      .tz = _mm512_set1_pd(row->tv.z),
+      .box = _mm512_set1_pd(L),
+      .inv_box = _mm512_set1_pd(1.0 / L),
+      .r_cut_2 = _mm512_set1_pd(row->r_cut_2)
+    };
+}
+
+// Particles j k to k + 7 seen from i, with their pairs under r_cut in mask.
+// Returns the square distances, harmless outside of mask
+__attribute__ ((target("avx512f")))
+static inline __m512d distance_avx512(const struct pair_row *restrict row,
+                                      const struct row_avx512 *restrict c,
+                                      const uint64_t k,
+                                      __mmask8 *restrict valid,
+                                      __mmask8 *restrict mask,
+                                      __m512d *restrict dx,
+                                      __m512d *restrict dy,
+                                      __m512d *restrict dz)
+{
+  const uint64_t left = k < row->n ? row->n - k : 0;
+
+  *valid = left >= 8 ? 0xFF : (__mmask8)((1u << left) - 1);
+
+  *dx = _mm512_sub_pd(c->xi, _mm512_maskz_loadu_pd(*valid, row->x + k));
+  *dy = _mm512_sub_pd(c->yi, _mm512_maskz_loadu_pd(*valid, row->y + k));
+  *dz = _mm512_sub_pd(c->zi, _mm512_maskz_loadu_pd(*valid, row->z + k));
+
+  if (row->wrap)
+    {
+      const int round = _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC;
+
+      *dx = _mm512_fnmadd_pd(c->box, _mm512_roundscale_pd(_mm512_mul_pd(*dx, c->inv_box), round), *dx);
+      *dy = _mm512_fnmadd_pd(c->box, _mm512_roundscale_pd(_mm512_mul_pd(*dy, c->inv_box), round), *dy);
+      *dz = _mm512_fnmadd_pd(c->box, _mm512_roundscale_pd(_mm512_mul_pd(*dz, c->inv_box), round), *dz);
+    }
+
+  *dx = _mm512_sub_pd(*dx, c->tx);
+  *dy = _mm512_sub_pd(*dy, c->ty);
+  *dz = _mm512_sub_pd(*dz, c->tz);
+
+  __m512d distance = _mm512_mul_pd(*dx, *dx);
+  distance = _mm512_fmadd_pd(*dy, *dy, distance);
+  distance = _mm512_fmadd_pd(*dz, *dz, distance);
+
+  *mask = _mm512_mask_cmp_pd_mask(*valid, distance, c->r_cut_2, _CMP_LE_OQ);
+
+  return _mm512_mask_blend_pd(*mask, _mm512_set1_pd(1.0), distance);
+}
+
+// Forces of the pairs of particles j k to k + 7, from du_ij
+__attribute__ ((target("avx512f")))
+static inline void forces_avx512(const struct pair_row *restrict row,
+                                 const uint64_t k, const __mmask8 valid,
+                                 const __m512d du_ij, const __m512d dx,
+                                 const __m512d dy, const __m512d dz,
+                                 __m512d *restrict sfx, __m512d *restrict sfy,
+                                 __m512d *restrict sfz)
+{
+  const __m512d fx = _mm512_mul_pd(du_ij, dx);
+  const __m512d fy = _mm512_mul_pd(du_ij, dy);
+  const __m512d fz = _mm512_mul_pd(du_ij, dz);
+
+  *sfx = _mm512_add_pd(*sfx, fx);
+  *sfy = _mm512_add_pd(*sfy, fy);
+  *sfz = _mm512_add_pd(*sfz, fz);
+
+  // Forces on particles j
+  _mm512_mask_storeu_pd(row->fx + k, valid,
+                        _mm512_sub_pd(_mm512_maskz_loadu_pd(valid, row->fx + k), fx));
+  _mm512_mask_storeu_pd(row->fy + k, valid,
+                        _mm512_sub_pd(_mm512_maskz_loadu_pd(valid, row->fy + k), fy));
+  _mm512_mask_storeu_pd(row->fz + k, valid,
+                        _mm512_sub_pd(_mm512_maskz_loadu_pd(valid, row->fz + k), fz));
+}
+
+// 8 particles j per iteration, the cutoff and the tail are handled with masks
+__attribute__ ((target("avx512f")))
+void pair_kernel_avx512(const struct pair_row *restrict row,
+                        struct force *restrict f_i,
+                        double *restrict energy)
+{
+  const __m512d r_star_2 = _mm512_set1_pd(square(R_STAR));
+  const __m512d two = _mm512_set1_pd(2.0);
+  const __m512d c_du = _mm512_set1_pd(-48.0 * EPSILON_STAR);
+
+  const struct row_avx512 c = init_row_avx512(row);
+
+  __m512d e = _mm512_setzero_pd();
+  __m512d sfx = _mm512_setzero_pd();
+  __m512d sfy = _mm512_setzero_pd();
+  __m512d sfz = _mm512_setzero_pd();
+
+  for (uint64_t k = 0; k < row->n; k += 8)
+    {
+      __mmask8 valid, mask;
+      __m512d dx, dy, dz;
+
+      const __m512d distance =
+        distance_avx512(row, &c, k, &valid, &mask, &dx, &dy, &dz);
+
+      const __m512d r = _mm512_div_pd(r_star_2, distance);
+      const __m512d r_2 = _mm512_mul_pd(r, r);
+      const __m512d r_3 = _mm512_mul_pd(r_2, r);
+      const __m512d r_4 = _mm512_mul_pd(r_2, r_2);
+      const __m512d r_6 = _mm512_mul_pd(r_3, r_3);
+      const __m512d r_7 = _mm512_mul_pd(r_6, r);
+
+      const __m512d u_ij = _mm512_fnmadd_pd(two, r_3, r_6);
+      const __m512d du_ij = _mm512_mul_pd(c_du, _mm512_sub_pd(r_7, r_4));
+
+      // Pairs over r_cut dropped
+      e = _mm512_add_pd(e, _mm512_maskz_mov_pd(mask, u_ij));
+
+      forces_avx512(row, k, valid, _mm512_maskz_mov_pd(mask, du_ij),
+                    dx, dy, dz, &sfx, &sfy, &sfz);
+    }
+
+  *energy += _mm512_reduce_add_pd(e);
+  f_i->fx += _mm512_reduce_add_pd(sfx);
+  f_i->fy += _mm512_reduce_add_pd(sfy);
+  f_i->fz += _mm512_reduce_add_pd(sfz);
+}
+
+// 8 particles j per iteration, with the powers of the distance of the 8
+// pairs in single precision, on 256 bits
+__attribute__ ((target("avx512f")))
+void pair_kernel_avx512_mixed(const struct pair_row *restrict row,
+                              struct force *restrict f_i,
+                              double *restrict energy)
+{
+  const __m256 r_star_2 = _mm256_set1_ps(square(R_STAR));
+  const __m256 two = _mm256_set1_ps(2.0f);
+  const __m256 c_du = _mm256_set1_ps(-48.0f * (float)EPSILON_STAR);
+
+  const struct row_avx512 c = init_row_avx512(row);
+
+  __m512d e = _mm512_setzero_pd();
+  __m512d sfx = _mm512_setzero_pd();
+  __m512d sfy = _mm512_setzero_pd();
+  __m512d sfz = _mm512_setzero_pd();
+
+  for (uint64_t k = 0; k < row->n; k += 8)
+    {
+      __mmask8 valid, mask;
+      __m512d dx, dy, dz;
+
+      const __m256 distance =
+        _mm512_cvtpd_ps(distance_avx512(row, &c, k, &valid, &mask, &dx, &dy, &dz));
+
+      const __m256 r = _mm256_div_ps(r_star_2, distance);
+      const __m256 r_2 = _mm256_mul_ps(r, r);
+      const __m256 r_3 = _mm256_mul_ps(r_2, r);
+      const __m256 r_4 = _mm256_mul_ps(r_2, r_2);
+      const __m256 r_6 = _mm256_mul_ps(r_3, r_3);
+      const __m256 r_7 = _mm256_mul_ps(r_6, r);
+
+      const __m256 u_ij = _mm256_sub_ps(r_6, _mm256_mul_ps(two, r_3));
+      const __m256 du_ij = _mm256_mul_ps(c_du, _mm256_sub_ps(r_7, r_4));
+
+      // Back to double precision, pairs over r_cut dropped
+      e = _mm512_add_pd(e, _mm512_maskz_mov_pd(mask, _mm512_cvtps_pd(u_ij)));
+
+      forces_avx512(row, k, valid, _mm512_maskz_mov_pd(mask, _mm512_cvtps_pd(du_ij)),
+                    dx, dy, dz, &sfx, &sfy, &sfz);
+    }
+
+  *energy += _mm512_reduce_add_pd(e);
+  f_i->fx += _mm512_reduce_add_pd(sfx);
+  f_i->fy += _mm512_reduce_add_pd(sfy);
+  f_i->fz += _mm512_reduce_add_pd(sfz);
+}
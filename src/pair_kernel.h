@@ -0,0 +1,30 @@
+#ifndef _PAIR_KERNEL_H_
+#define _PAIR_KERNEL_H_
+
+// Widest pair kernel supported by the running CPU, of precision
+pair_kernel select_pair_kernel(const uint64_t precision);
+const char *pair_kernel_name(const pair_kernel kernel);
+
+//
+void pair_kernel_scalar(const struct pair_row *restrict row,
+                        struct force *restrict f_i,
+                        double *restrict energy);
+void pair_kernel_avx2(const struct pair_row *restrict row,
+                      struct force *restrict f_i,
+                      double *restrict energy);
+void pair_kernel_avx512(const struct pair_row *restrict row,
+                        struct force *restrict f_i,
+                        double *restrict energy);
+
+// Powers of the distance in single precision, the rest in double precision
+void pair_kernel_scalar_mixed(const struct pair_row *restrict row,
+                              struct force *restrict f_i,
+                              double *restrict energy);
+void pair_kernel_avx2_mixed(const struct pair_row *restrict row,
+                            struct force *restrict f_i,
+                            double *restrict energy);
+void pair_kernel_avx512_mixed(const struct pair_row *restrict row,
+                              struct force *restrict f_i,
+                              double *restrict energy);
+
+#endif // _PAIR_KERNEL_H_
@@ -0,0 +1,189 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <omp.h>
+
+#include "helper.h"
+#include "perf_counter.h"
+
+// Bytes loaded from memory by a last level cache miss
+#define CACHE_LINE 64
+
+//
+struct perf_counters perf_counters = { .enabled = 0 };
+
+static const char *const region_name[N_PERF_REGIONS] =
+  {
+    "lennard_jones",
+    "periodical_lennard_jones",
+    "forces",
+    "integration"
+  };
+
+// Floating point instructions retired, by width of double precision
+// operands, as umask of event 0xc7 on Intel processors. FMA count twice
+static const uint64_t fp_umask[4] = { 0x01, 0x04, 0x10, 0x40 };
+
+//
+static int open_event(const uint32_t type, const uint64_t config)
+{
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+
+  attr.size = sizeof(attr);
+  attr.type = type;
+  attr.config = config;
+  attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+  attr.inherit = 1;
+
+  // Allowed without privilege up to perf_event_paranoid 2
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+
+  return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+void init_perf_counters(void)
+{
+  int *restrict fd = perf_counters.fd;
+
+  fd[PERF_CYCLES] = open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+
+  if (fd[PERF_CYCLES] < 0)
+    {
+      if (RANK == 0)
+        printf("Warning: performance counters unavailable (%s), check "
+               "/proc/sys/kernel/perf_event_paranoid\n", strerror(errno));
+
+      return;
+    }
+
+  fd[PERF_INSTRUCTIONS] = open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+  fd[PERF_LLC_MISSES] = open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+
+  // Raw events, meaningful on Intel processors only
+  __builtin_cpu_init();
+
+  for (uint64_t k = 0; k < 4; k++)
+    fd[PERF_FP_SCALAR + k] = __builtin_cpu_is("intel") ?
+      open_event(PERF_TYPE_RAW, fp_umask[k] << 8 | 0xc7) : -1;
+
+  memset(perf_counters.count, 0, sizeof(perf_counters.count));
+  memset(perf_counters.calls, 0, sizeof(perf_counters.calls));
+  perf_counters.enabled = 1;
+}
+
+//
+static void read_events(struct perf_count *restrict c)
+{
+  for (uint64_t e = 0; e < N_PERF_EVENTS; e++)
+    if (perf_counters.fd[e] < 0 ||
+        read(perf_counters.fd[e], &c[e], sizeof(struct perf_count)) !=
+        sizeof(struct perf_count))
+      c[e] = (struct perf_count){ 0, 0, 0 };
+}
+
+void perf_counters_start(__attribute__ ((unused)) const uint64_t region)
+{
+  // Not inside parallel regions, where replicas of an ensemble would share
+  // the start counts
+  if (!perf_counters.enabled || omp_in_parallel())
+    return;
+
+  read_events(perf_counters.start);
+}
+
+void perf_counters_stop(const uint64_t region)
+{
+  if (!perf_counters.enabled || omp_in_parallel())
+    return;
+
+  struct perf_count c[N_PERF_EVENTS];
+  read_events(c);
+
+  for (uint64_t e = 0; e < N_PERF_EVENTS; e++)
+    {
+      const struct perf_count *restrict s = &perf_counters.start[e];
+      const uint64_t running = c[e].running - s->running;
+
+      // Scaled to the time enabled, when the event shared its counter
+      if (running)
+        perf_counters.count[region][e] += (double)(c[e].value - s->value) *
+          (double)(c[e].enabled - s->enabled) / (double)running;
+    }
+
+  perf_counters.calls[region]++;
+}
+
+// Value, or - for an event not counted
+static void print_count(const uint64_t e, const double value)
+{
+  if (perf_counters.fd[e] < 0)
+    printf("%14s ", "-");
+  else
+    printf("%14e ", value);
+}
+
+void print_perf_counters(void)
+{
+  if (!perf_counters.enabled)
+    return;
+
+  const int *restrict fd = perf_counters.fd;
+  const uint64_t has_fp =
+    fd[PERF_FP_SCALAR] >= 0 && fd[PERF_FP_128] >= 0 &&
+    fd[PERF_FP_256] >= 0 && fd[PERF_FP_512] >= 0;
+
+  printf("== Performance counters ==\n");
+  printf("%-26s %14s %14s %14s %14s %14s %8s %10s\n", "REGION", "CYCLES",
+         "INSTRUCTIONS", "LLC_MISSES", "VECTOR_INS", "FLOP", "IPC",
+         "BYTES/FLOP");
+
+  for (uint64_t r = 0; r < N_PERF_REGIONS; r++)
+    {
+      if (!perf_counters.calls[r])
+        continue;
+
+      const double *restrict c = perf_counters.count[r];
+      const double vector = c[PERF_FP_128] + c[PERF_FP_256] + c[PERF_FP_512];
+      const double flop = c[PERF_FP_SCALAR] + 2.0 * c[PERF_FP_128] +
+        4.0 * c[PERF_FP_256] + 8.0 * c[PERF_FP_512];
+
+      printf("%-26s ", region_name[r]);
+      print_count(PERF_CYCLES, c[PERF_CYCLES]);
+      print_count(PERF_INSTRUCTIONS, c[PERF_INSTRUCTIONS]);
+      print_count(PERF_LLC_MISSES, c[PERF_LLC_MISSES]);
+
+      if (has_fp)
+        printf("%14e %14e ", vector, flop);
+      else
+        printf("%14s %14s ", "-", "-");
+
+      if (fd[PERF_INSTRUCTIONS] >= 0 && c[PERF_CYCLES] > 0.0)
+        printf("%8.3lf ", c[PERF_INSTRUCTIONS] / c[PERF_CYCLES]);
+      else
+        printf("%8s ", "-");
+
+      if (has_fp && fd[PERF_LLC_MISSES] >= 0 && flop > 0.0)
+        printf("%10.4lf\n", CACHE_LINE * c[PERF_LLC_MISSES] / flop);
+      else
+        printf("%10s\n", "-");
+    }
+
+  printf("\n");
+}
+
+void free_perf_counters(void)
+{
+  if (!perf_counters.enabled)
+    return;
+
+  for (uint64_t e = 0; e < N_PERF_EVENTS; e++)
+    if (perf_counters.fd[e] >= 0)
+      close(perf_counters.fd[e]);
+
+  perf_counters.enabled = 0;
+}
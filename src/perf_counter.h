@@ -0,0 +1,38 @@
+#ifndef _PERF_COUNTER_H_
+#define _PERF_COUNTER_H_
+
+// Counters of the running simulation
+extern struct perf_counters perf_counters;
+
+/**
+ * init_perf_counters - Open the hardware events of the process, counted in
+ *                      the threads it creates from now on. Counters stay
+ *                      disabled when the kernel does not allow it
+ */
+void init_perf_counters(void);
+
+/**
+ * perf_counters_start - Read the events when entering region
+ * @param region: region of code
+ */
+void perf_counters_start(const uint64_t region);
+
+/**
+ * perf_counters_stop - Add the events since perf_counters_start to region
+ * @param region: region of code
+ */
+void perf_counters_stop(const uint64_t region);
+
+/**
+ * print_perf_counters - Print the events of every region entered, with the
+ *                       instructions per cycle and the bytes loaded from
+ *                       memory per floating point operation
+ */
+void print_perf_counters(void);
+
+/**
+ * free_perf_counters - Close the events
+ */
+void free_perf_counters(void);
+
+#endif // _PERF_COUNTER_H_
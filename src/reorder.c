@@ -0,0 +1,177 @@
+#include <stdlib.h>
+#include <math.h>
+
+#include "helper.h"
+#include "arena.h"
+#include "neighbour_list.h"
+#include "reorder.h"
+
+// Bits of the Morton key per dimension, and of each radix sort pass
+#define MORTON_BITS 10
+#define RADIX_BITS  10
+#define RADIX       (1 << RADIX_BITS)
+
+struct reorder *init_reorder(void)
+{
+  const uint64_t n = N_PARTICLES_TOTAL;
+
+  // Allocate memory
+  struct reorder *restrict r = arena_alloc(sizeof(struct reorder));
+
+  r->id = arena_alloc(sizeof(uint64_t) * n);
+  r->order = arena_alloc(sizeof(uint64_t) * n);
+  r->tmp = arena_alloc(sizeof(uint64_t) * n);
+  r->key = arena_alloc(sizeof(uint32_t) * n);
+  r->key_tmp = arena_alloc(sizeof(uint32_t) * n);
+  r->scratch = arena_alloc(sizeof(double) * n);
+  r->n_sort = 0;
+
+  for (uint64_t i = 0; i < n; i++)
+    r->id[i] = i;
+
+  return r;
+}
+
+void free_reorder(struct reorder *restrict r)
+{
+  arena_free(r->id);
+  arena_free(r->order);
+  arena_free(r->tmp);
+  arena_free(r->key);
+  arena_free(r->key_tmp);
+  arena_free(r->scratch);
+  arena_free(r);
+}
+
+// Spread the MORTON_BITS low bits of v, two zero bits between each
+static inline uint32_t spread_bits(uint32_t v)
+{
+  v &= 0x3ff;
+  v = (v | (v << 16)) & 0x030000ff;
+  v = (v | (v << 8)) & 0x0300f00f;
+  v = (v | (v << 4)) & 0x030c30c3;
+  v = (v | (v << 2)) & 0x09249249;
+
+  return v;
+}
+
+// Cell of a coordinate, on a grid of 2^MORTON_BITS cells per side of the
+// periodic box
+static inline uint32_t morton_cell(const double x)
+{
+  const double w = x - L * floor(x / L);
+  const int64_t c = (int64_t)(w * ((1 << MORTON_BITS) / L));
+
+  return c < 0 ? 0 : (c >= (1 << MORTON_BITS) ? (1 << MORTON_BITS) - 1 : c);
+}
+
+// Sort the indices of the particles by key, least significant digit first
+static void radix_sort(struct reorder *restrict r)
+{
+  const uint64_t n = N_PARTICLES_TOTAL;
+
+  uint32_t *restrict key = r->key;
+  uint32_t *restrict key_tmp = r->key_tmp;
+  uint64_t *restrict order = r->order;
+  uint64_t *restrict tmp = r->tmp;
+
+  for (uint64_t i = 0; i < n; i++)
+    order[i] = i;
+
+  for (uint64_t shift = 0; shift < 3 * MORTON_BITS; shift += RADIX_BITS)
+    {
+      uint64_t count[RADIX + 1] = { 0 };
+
+      for (uint64_t i = 0; i < n; i++)
+        count[((key[i] >> shift) & (RADIX - 1)) + 1]++;
+
+      for (uint64_t b = 0; b < RADIX; b++)
+        count[b + 1] += count[b];
+
+      for (uint64_t i = 0; i < n; i++)
+        {
+          const uint64_t k = count[(key[i] >> shift) & (RADIX - 1)]++;
+
+          key_tmp[k] = key[i];
+          tmp[k] = order[i];
+        }
+
+      uint32_t *swap_key = key;
+      key = key_tmp;
+      key_tmp = swap_key;
+
+      uint64_t *swap_order = order;
+      order = tmp;
+      tmp = swap_order;
+    }
+
+  // An odd number of passes leaves the result in the temporary arrays
+  r->key = key;
+  r->key_tmp = key_tmp;
+  r->order = order;
+  r->tmp = tmp;
+}
+
+// Move v[order[k]] to v[k], through the scratch array swapped with v
+static void permute(struct reorder *restrict r, double *restrict *v)
+{
+  double *restrict dst = r->scratch;
+  const double *restrict src = *v;
+
+  for (uint64_t k = 0; k < N_PARTICLES_TOTAL; k++)
+    dst[k] = src[r->order[k]];
+
+  r->scratch = *v;
+  *v = dst;
+}
+
+void reorder_particles(struct reorder *restrict r,
+                       struct particle *restrict p,
+                       struct kinetic_moment *restrict km,
+                       struct lennard_jones *restrict plj)
+{
+  const uint64_t n = N_PARTICLES_TOTAL;
+
+  // Morton key of each particle
+  for (uint64_t i = 0; i < n; i++)
+    r->key[i] =
+      spread_bits(morton_cell(p->x[i])) << 2 |
+      spread_bits(morton_cell(p->y[i])) << 1 |
+      spread_bits(morton_cell(p->z[i]));
+
+  radix_sort(r);
+
+  // Identifiers
+  for (uint64_t k = 0; k < n; k++)
+    r->tmp[k] = r->id[r->order[k]];
+
+  uint64_t *swap = r->id;
+  r->id = r->tmp;
+  r->tmp = swap;
+
+  // State of the particles
+  permute(r, &p->x);
+  permute(r, &p->y);
+  permute(r, &p->z);
+
+  permute(r, &km->px);
+  permute(r, &km->py);
+  permute(r, &km->pz);
+
+  permute(r, &plj->sum_i->fx);
+  permute(r, &plj->sum_i->fy);
+  permute(r, &plj->sum_i->fz);
+
+  // Same list, with the new indices
+  if (plj->nl)
+    {
+      permute(r, &plj->nl->p0->x);
+      permute(r, &plj->nl->p0->y);
+      permute(r, &plj->nl->p0->z);
+
+      if (plj->nl->n_build)
+        reorder_neighbour_list(plj->nl);
+    }
+
+  r->n_sort++;
+}
@@ -0,0 +1,29 @@
+#ifndef _REORDER_H_
+#define _REORDER_H_
+
+/**
+ * init_reorder - Particles in the order of the input file
+ * @return order of the N_PARTICLES_TOTAL particles
+ */
+struct reorder *init_reorder(void);
+
+/**
+ * free_reorder - Release memory
+ * @param r: order of the particles
+ */
+void free_reorder(struct reorder *restrict r);
+
+/**
+ * reorder_particles - Sort particles along a Morton curve of the box, so
+ *                     that particles close in space are close in memory
+ * @param r  : order of the particles, updated
+ * @param p  : positions of particles, moved
+ * @param km : kinetic moments, moved
+ * @param plj: forces of the last step and neighbour list, moved
+ */
+void reorder_particles(struct reorder *restrict r,
+                       struct particle *restrict p,
+                       struct kinetic_moment *restrict km,
+                       struct lennard_jones *restrict plj);
+
+#endif // _REORDER_H_
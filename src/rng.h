@@ -0,0 +1,43 @@
+#ifndef _RNG_H_
+#define _RNG_H_
+
+// Counter based generator: the draw number counter of a stream is the
+// SplitMix64 output at position counter of a sequence whose origin is
+// hashed from the seed and the stream. Draws need no state, so that threads
+// share them out in any order with the same result
+
+// Increment of the SplitMix64 sequence, from the golden ratio
+#define RNG_GAMMA 0x9e3779b97f4a7c15UL
+
+//
+static inline uint64_t rng_mix(uint64_t z)
+{
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9UL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebUL;
+
+  return z ^ (z >> 31);
+}
+
+/**
+ * rng_key - Origin of a stream of a seed
+ * @param seed  : seed of the run
+ * @param stream: index of the stream, one per replica
+ * @return key of the stream
+ */
+static inline uint64_t rng_key(const uint64_t seed, const uint64_t stream)
+{
+  return rng_mix(seed ^ rng_mix((stream + 1) * RNG_GAMMA));
+}
+
+/**
+ * rng_uniform - Draw of a stream
+ * @param key    : key of the stream
+ * @param counter: index of the draw
+ * @return uniform in [0, 1)
+ */
+static inline double rng_uniform(const uint64_t key, const uint64_t counter)
+{
+  return (rng_mix(key + (counter + 1) * RNG_GAMMA) >> 11) * 0x1.0p-53;
+}
+
+#endif // _RNG_H_
@@ -0,0 +1,98 @@
+#include <stdlib.h>
+#include <math.h>
+
+#include "helper.h"
+#include "timer.h"
+
+//
+_Thread_local struct timers timers = { .n_steps = 0, .step = 0 };
+
+static const char *const timer_name[N_TIMERS] =
+  {
+    "forces",
+    "integration",
+    "kinetic_energy",
+    "thermostat",
+    "io",
+    "reorder"
+  };
+
+void init_timers(const uint64_t n_steps)
+{
+  timers.n_steps = n_steps;
+  timers.step = 0;
+
+  for (uint64_t phase = 0; phase < N_TIMERS; phase++)
+    {
+      timers.current[phase] = 0.0;
+      timers.samples[phase] = malloc(sizeof(double) * (n_steps ? n_steps : 1));
+    }
+
+  timers.wall = timer_now();
+}
+
+//
+static int compare_double(const void *a, const void *b)
+{
+  const double x = *(const double *)a;
+  const double y = *(const double *)b;
+
+  return (x > y) - (x < y);
+}
+
+// Nearest rank percentile of n sorted samples
+static double percentile(const double *restrict sorted, const uint64_t n,
+                         const double q)
+{
+  const uint64_t rank = (uint64_t)ceil(q * (double)n);
+
+  return sorted[rank ? rank - 1 : 0];
+}
+
+void print_timers(void)
+{
+  const double wall = timer_now() - timers.wall;
+  const uint64_t n = timers.step < timers.n_steps ? timers.step : timers.n_steps;
+
+  if (n == 0)
+    return;
+
+  printf("== Timers ==\n");
+  printf("%-16s %14s %14s %14s %14s %8s\n",
+         "PHASE", "TOTAL (s)", "MEAN (s)", "P50 (s)", "P99 (s)", "WALL");
+
+  double timed = 0.0;
+
+  for (uint64_t phase = 0; phase < N_TIMERS; phase++)
+    {
+      double *restrict s = timers.samples[phase];
+      double total = 0.0;
+
+      for (uint64_t step = 0; step < n; step++)
+        total += s[step];
+
+      qsort(s, n, sizeof(double), compare_double);
+
+      printf("%-16s %14e %14e %14e %14e %7.2lf%%\n", timer_name[phase],
+             total, total / n, percentile(s, n, 0.5), percentile(s, n, 0.99),
+             100.0 * total / wall);
+
+      timed += total;
+    }
+
+  printf("%-16s %14e %14s %14s %14s %7.2lf%%\n", "other", wall - timed,
+         "", "", "", 100.0 * (wall - timed) / wall);
+  printf("%-16s %14e\n", "wall", wall);
+  printf("\n");
+}
+
+void free_timers(void)
+{
+  for (uint64_t phase = 0; phase < N_TIMERS; phase++)
+    {
+      free(timers.samples[phase]);
+      timers.samples[phase] = NULL;
+    }
+
+  timers.n_steps = 0;
+}
@@ -0,0 +1,71 @@
+#ifndef _TIMER_H_
+#define _TIMER_H_
+
+#include <time.h>
+
+// Timers of the running simulation, one set per thread so that replicas of
+// an ensemble do not share them
+extern _Thread_local struct timers timers;
+
+/**
+ * init_timers - Start the wall clock and reserve the samples of n_steps steps
+ * @param n_steps: number of steps to time
+ */
+void init_timers(const uint64_t n_steps);
+
+/**
+ * print_timers - Print total, mean, median and 99th percentile per step of
+ *                every phase, and its share of the wall time
+ */
+void print_timers(void);
+
+/**
+ * free_timers - Release the samples
+ */
+void free_timers(void);
+
+//
+static inline double timer_now(void)
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+
+  return t.tv_sec + t.tv_nsec * 1.0e-9;
+}
+
+// Phases may be started and stopped several times during a step
+static inline void timer_start(const uint64_t phase)
+{
+  timers.start[phase] = timer_now();
+}
+
+static inline void timer_stop(const uint64_t phase)
+{
+  timers.current[phase] += timer_now() - timers.start[phase];
+}
+
+// Store the time of every phase for the current step, and start the next one
+static inline void timer_step(void)
+{
+  if (timers.step < timers.n_steps)
+    for (uint64_t phase = 0; phase < N_TIMERS; phase++)
+      timers.samples[phase][timers.step] = timers.current[phase];
+
+  for (uint64_t phase = 0; phase < N_TIMERS; phase++)
+    timers.current[phase] = 0.0;
+
+  timers.step++;
+}
+
+// Expand to nothing unless built with TIMERS
+#if TIMERS
+#define TIMER_START(phase) timer_start(phase)
+#define TIMER_STOP(phase)  timer_stop(phase)
+#define TIMER_STEP()       timer_step()
+#else
+#define TIMER_START(phase)
+#define TIMER_STOP(phase)
+#define TIMER_STEP()
+#endif
+
+#endif // _TIMER_H_
@@ -3,22 +3,39 @@
 #include <time.h>
 
 #include "helper.h"
+#include "common.h"
 #include "lennard_jones.h"
+#include "domain.h"
+#include "timer.h"
+#include "perf_counter.h"
+#include "arena.h"
+#include "rng.h"
 #include "velocity_verlet.h"
 
 // x if y >= 0.0, -x else
 #define sign_function(x, y) (y < 0.0 ? -x : x)
 
-// Initialize seed
+// Kinetic moments are summed by blocks of particles, added in order, so that
+// they do not depend on the number of threads
+#define MOMENT_BLOCK 4096
+
+// Initialize seed, from the time unless SEED is set
 static inline void init_random(void)
 {
-  srand(time(NULL));
+  uint64_t seed = SEED ? SEED : (uint64_t)time(NULL);
+
+#if MPI
+  // Same kinetic moments on every process
+  MPI_Bcast(&seed, 1, MPI_UINT64_T, 0, MPI_COMM_WORLD);
+#endif
+
+  SEED = seed;
 }
 
 struct ket *init_ket(void)
 {
   // Allocate return structure
-  struct ket *restrict ket = aligned_alloc(ALIGN, sizeof(struct ket));
+  struct ket *restrict ket = arena_alloc(sizeof(struct ket));
 
   ket->kinetic_energy = 0.0;
   ket->temperature = 0.0;
@@ -26,107 +43,177 @@ struct ket *init_ket(void)
   return ket;
 }
 
+// Set kinetic energy and temperature from the sum of the square kinetic
+// moments of the local particles
+static void set_kinetic_energy_and_temperature(struct ket *restrict ket,
+                                               double kinetic_energy)
+{
+#if MPI
+  // Sum over the subdomains
+  if (!LOCAL_EQUAL_TOTAL)
+    MPI_Allreduce(MPI_IN_PLACE, &kinetic_energy, 1, MPI_DOUBLE, MPI_SUM,
+                  MPI_COMM_WORLD);
+#endif
+
+  ket->kinetic_energy = kinetic_energy / (M_I * FORCE_CONVERSION_x2);
+
+  // Temperature
+  ket->temperature = ket->kinetic_energy / (N_DL * R_CONSTANT);
+}
+
 void compute_kinetic_energy_and_temperature(struct ket *restrict ket,
                                             const struct kinetic_moment
                                             *restrict km)
 {
   // Kinetic energy
-  ket->kinetic_energy = 0.0;
+  double kinetic_energy = 0.0;
 
-  for (uint64_t i = 0; i < N_PARTICLES_TOTAL; i++)
+#pragma omp parallel for schedule(static) reduction(+:kinetic_energy)
+  for (uint64_t i = 0; i < N_PARTICLES_LOCAL; i++)
     {
-      ket->kinetic_energy += square(km[i].px) + square(km[i].py) + square(km[i].pz);
+      kinetic_energy += square(km->px[i]) + square(km->py[i]) + square(km->pz[i]);
     }
 
-  ket->kinetic_energy /= (M_I * FORCE_CONVERSION_x2);
-
-  // Temperature
-  ket->temperature = ket->kinetic_energy / (N_DL * R_CONSTANT);
+  set_kinetic_energy_and_temperature(ket, kinetic_energy);
 }
 
 void free_ket(struct ket *restrict ket)
 {
-  free(ket);
+  arena_free(ket);
 }
 
-static void first_recalibration(struct kinetic_moment *restrict km)
+// Sums of kinetic moments, and of their squares
+struct ket_sum
+{
+  double px;
+  double py;
+  double pz;
+  double p_2;
+};
+
+// Of every particle
+static struct ket_sum sum_kinetic_moment(const struct kinetic_moment *restrict km)
 {
-  // Compute kinetic energy and temperature for this kinetic moment
-  struct ket *restrict ket = init_ket();
-  compute_kinetic_energy_and_temperature(ket, km);
+  const uint64_t n_blocks = (N_PARTICLES_TOTAL + MOMENT_BLOCK - 1) / MOMENT_BLOCK;
 
-  // Recalibration
-  double rapport = sqrt((N_DL * R_CONSTANT * T_0) / ket->kinetic_energy);
+  // Scratch, given back to the arena on return
+  const uint64_t mark = arena_mark();
+  struct ket_sum *restrict block = arena_alloc(sizeof(struct ket_sum) * n_blocks);
 
-  for (uint64_t i = 0; i < N_PARTICLES_TOTAL; i++)
+#pragma omp parallel for schedule(static)
+  for (uint64_t b = 0; b < n_blocks; b++)
     {
-      km[i].px *= rapport;
-      km[i].py *= rapport;
-      km[i].pz *= rapport;
+      const uint64_t last =
+        (b + 1) * MOMENT_BLOCK < N_PARTICLES_TOTAL ? (b + 1) * MOMENT_BLOCK : N_PARTICLES_TOTAL;
+
+      struct ket_sum s = { 0.0, 0.0, 0.0, 0.0 };
+
+      for (uint64_t i = b * MOMENT_BLOCK; i < last; i++)
+        {
+          s.px += km->px[i];
+          s.py += km->py[i];
+          s.pz += km->pz[i];
+          s.p_2 += square(km->px[i]) + square(km->py[i]) + square(km->pz[i]);
+        }
+
+      block[b] = s;
+    }
+
+  struct ket_sum sum = { 0.0, 0.0, 0.0, 0.0 };
+
+  for (uint64_t b = 0; b < n_blocks; b++)
+    {
+      sum.px += block[b].px;
+      sum.py += block[b].py;
+      sum.pz += block[b].pz;
+      sum.p_2 += block[b].p_2;
     }
 
-  // Release memroy
-  free_ket(ket);
+  arena_free(block);
+  arena_release(mark);
+
+  return sum;
 }
 
-static void second_recalibration(struct kinetic_moment *restrict km)
+static void first_recalibration(struct kinetic_moment *restrict km)
 {
-  struct kinetic_moment sum_km =
-    {
-      .px = 0.0,
-      .py = 0.0,
-      .pz = 0.0
-    };
+  // Compute kinetic energy for this kinetic moment
+  const double kinetic_energy =
+    sum_kinetic_moment(km).p_2 / (M_I * FORCE_CONVERSION_x2);
+
+  // Recalibration
+  double rapport = sqrt((N_DL * R_CONSTANT * T_0) / kinetic_energy);
 
+#pragma omp parallel for schedule(static)
   for (uint64_t i = 0; i < N_PARTICLES_TOTAL; i++)
     {
-      sum_km.px += km[i].px;
-      sum_km.py += km[i].py;
-      sum_km.pz += km[i].pz;
+      km->px[i] *= rapport;
+      km->py[i] *= rapport;
+      km->pz[i] *= rapport;
     }
+}
+
+static void second_recalibration(struct kinetic_moment *restrict km)
+{
+  const struct ket_sum sum = sum_kinetic_moment(km);
 
-  sum_km.px /= N_PARTICLES_TOTAL;
-  sum_km.py /= N_PARTICLES_TOTAL;
-  sum_km.pz /= N_PARTICLES_TOTAL;
+  const double sum_px = sum.px / N_PARTICLES_TOTAL;
+  const double sum_py = sum.py / N_PARTICLES_TOTAL;
+  const double sum_pz = sum.pz / N_PARTICLES_TOTAL;
 
+#pragma omp parallel for schedule(static)
   for (uint64_t i = 0; i < N_PARTICLES_TOTAL; i++)
     {
-      km[i].px -= sum_km.px;
-      km[i].py -= sum_km.py;
-      km[i].pz -= sum_km.pz;
+      km->px[i] -= sum_px;
+      km->py[i] -= sum_py;
+      km->pz[i] -= sum_pz;
     }
 }
 
-struct kinetic_moment *init_velocity_verlet(void)
+struct kinetic_moment *init_kinetic_moment(void)
 {
   // Set the number of degree of liberty
   N_DL = 3 * N_PARTICLES_TOTAL - 3;
 
-  // Initial kinetic moment generation
+  // Allocate memory
   struct kinetic_moment *restrict km =
-    aligned_alloc(ALIGN, sizeof(struct kinetic_moment) * N_PARTICLES_TOTAL);
+    arena_alloc(sizeof(struct kinetic_moment));
 
-  double c = 0.0;
-  double s = 0.0;
+  km->px = arena_alloc(sizeof(double) * N_PARTICLES_TOTAL);
+  km->py = arena_alloc(sizeof(double) * N_PARTICLES_TOTAL);
+  km->pz = arena_alloc(sizeof(double) * N_PARTICLES_TOTAL);
 
-  init_random();
+  return km;
+}
+
+// Kinetic moments drawn from stream of SEED, six draws per particle
+static struct kinetic_moment *draw_kinetic_moment(const uint64_t stream)
+{
+  // Initial kinetic moment generation
+  struct kinetic_moment *restrict km = init_kinetic_moment();
 
+  const uint64_t key = rng_key(SEED, stream);
+
+#pragma omp parallel for schedule(static)
   for (uint64_t i = 0; i < N_PARTICLES_TOTAL; i++)
     {
+      double c = 0.0;
+      double s = 0.0;
+
       // x
-      c = (double)rand() / (double)RAND_MAX;
-      s = (double)rand() / (double)RAND_MAX;
-      km[i].px = sign_function(1.0, 0.5 - s) * c;
+      c = rng_uniform(key, 6 * i + 0);
+      s = rng_uniform(key, 6 * i + 1);
+      km->px[i] = sign_function(1.0, 0.5 - s) * c;
 
       // y
-      c = (double)rand() / (double)RAND_MAX;
-      s = (double)rand() / (double)RAND_MAX;
-      km[i].py = sign_function(1.0, 0.5 - s) * c;
+      c = rng_uniform(key, 6 * i + 2);
+      s = rng_uniform(key, 6 * i + 3);
+      km->py[i] = sign_function(1.0, 0.5 - s) * c;
 
       // z
-      c = (double)rand() / (double)RAND_MAX;
-      s = (double)rand() / (double)RAND_MAX;
-      km[i].pz = sign_function(1.0, 0.5 - s) * c;
+      c = rng_uniform(key, 6 * i + 4);
+      s = rng_uniform(key, 6 * i + 5);
+      km->pz[i] = sign_function(1.0, 0.5 - s) * c;
     }
 
   // Recalibration
@@ -137,67 +224,113 @@ struct kinetic_moment *init_velocity_verlet(void)
   return km;
 }
 
+struct kinetic_moment *init_velocity_verlet(void)
+{
+  init_random();
+
+  return draw_kinetic_moment(0);
+}
+
+struct kinetic_moment *init_replica_velocity_verlet(const uint64_t replica)
+{
+  if (!SEED)
+    init_random();
+
+  // Stream 0 is the one of init_velocity_verlet
+  return draw_kinetic_moment(replica + 1);
+}
+
 void free_kinetic_moment(struct kinetic_moment *restrict km)
 {
-  free(km);
+  arena_free(km->px);
+  arena_free(km->py);
+  arena_free(km->pz);
+  arena_free(km);
+}
+
+void compute_forces(struct particle *restrict p,
+                    struct translation_vector *restrict tv,
+                    struct lennard_jones *restrict plj,
+                    const double r_cut)
+{
+  plj->engine->compute(plj, p, tv, r_cut);
 }
 
 void velocity_verlet(struct particle *restrict p,
-                     __attribute__ ((unused)) struct translation_vector *restrict tv,
+                     struct translation_vector *restrict tv,
                      struct lennard_jones *restrict plj,
                      struct kinetic_moment *restrict km,
-                     __attribute__ ((unused)) const double r_cut)
-{
-  // Compute forces
-#if CLASSICAL
-  lennard_jones(plj, p);
-#elif PERIODICAL
-  periodical_lennard_jones(plj, p, tv, r_cut, N_SYM);
-#else
-  lennard_jones(plj, p);
-#endif
-
-  // Update kinetic moments
-  for (uint64_t i = 0; i < N_PARTICLES_TOTAL; i++)
-    {
-      km[i].px -= DT * FORCE_CONVERSION * plj->sum_i[i].fx * 0.5;
-      km[i].py -= DT * FORCE_CONVERSION * plj->sum_i[i].fy * 0.5;
-      km[i].pz -= DT * FORCE_CONVERSION * plj->sum_i[i].fz * 0.5;
-    }
+                     struct ket *restrict ket,
+                     const double r_cut, const double thermostat)
+{
+  // Update kinetic moments, scaled by the thermostat, with the forces of the
+  // previous step, then positions, in one pass
+  TIMER_START(TIMER_INTEGRATION);
+  perf_counters_start(PERF_INTEGRATION);
 
-  // Update positions
-  for (uint64_t i = 0; i < N_PARTICLES_TOTAL; i++)
+#pragma omp parallel for schedule(static)
+  for (uint64_t i = 0; i < N_PARTICLES_LOCAL; i++)
     {
-      p[i].x += DT * km[i].px / M_I;
-      p[i].y += DT * km[i].py / M_I;
-      p[i].z += DT * km[i].pz / M_I;
+      const double px =
+        km->px[i] + km->px[i] * thermostat - DT * FORCE_CONVERSION * plj->sum_i->fx[i] * 0.5;
+      const double py =
+        km->py[i] + km->py[i] * thermostat - DT * FORCE_CONVERSION * plj->sum_i->fy[i] * 0.5;
+      const double pz =
+        km->pz[i] + km->pz[i] * thermostat - DT * FORCE_CONVERSION * plj->sum_i->fz[i] * 0.5;
+
+      km->px[i] = px;
+      km->py[i] = py;
+      km->pz[i] = pz;
+
+      p->x[i] += DT * px / M_I;
+      p->y[i] += DT * py / M_I;
+      p->z[i] += DT * pz / M_I;
     }
 
-  // Re-compute forces
-#if CLASSICAL
-  lennard_jones(plj, p);
-#elif PERIODICAL
-  periodical_lennard_jones(plj, p, tv, r_cut, N_SYM);
-#else
-  lennard_jones(plj, p);
+#if MPI
+  // Hand the particles that left the subdomain to their new owner
+  migrate_particles(plj->dd, p, km);
 #endif
 
-  // Update kinetic moments
-  for (uint64_t i = 0; i < N_PARTICLES_TOTAL; i++)
+  perf_counters_stop(PERF_INTEGRATION);
+  TIMER_STOP(TIMER_INTEGRATION);
+
+  // Re-compute forces, kept for the next step
+  TIMER_START(TIMER_FORCES);
+  perf_counters_start(PERF_FORCES);
+  compute_forces(p, tv, plj, r_cut);
+  perf_counters_stop(PERF_FORCES);
+  TIMER_STOP(TIMER_FORCES);
+
+  // Update kinetic moments and kinetic energy, in one pass
+  TIMER_START(TIMER_KINETIC_ENERGY);
+  perf_counters_start(PERF_INTEGRATION);
+
+  double kinetic_energy = 0.0;
+
+#pragma omp parallel for schedule(static) reduction(+:kinetic_energy)
+  for (uint64_t i = 0; i < N_PARTICLES_LOCAL; i++)
     {
-      km[i].px -= DT * FORCE_CONVERSION * plj->sum_i[i].fx * 0.5;
-      km[i].py -= DT * FORCE_CONVERSION * plj->sum_i[i].fy * 0.5;
-      km[i].pz -= DT * FORCE_CONVERSION * plj->sum_i[i].fz * 0.5;
+      const double px = km->px[i] - DT * FORCE_CONVERSION * plj->sum_i->fx[i] * 0.5;
+      const double py = km->py[i] - DT * FORCE_CONVERSION * plj->sum_i->fy[i] * 0.5;
+      const double pz = km->pz[i] - DT * FORCE_CONVERSION * plj->sum_i->fz[i] * 0.5;
+
+      km->px[i] = px;
+      km->py[i] = py;
+      km->pz[i] = pz;
+
+      kinetic_energy += square(px) + square(py) + square(pz);
     }
+
+  perf_counters_stop(PERF_INTEGRATION);
+
+  set_kinetic_energy_and_temperature(ket, kinetic_energy);
+
+  TIMER_STOP(TIMER_KINETIC_ENERGY);
 }
 
-void berendsen_thermostat(struct kinetic_moment *restrict km,
-                          struct ket *restrict ket)
+double berendsen_thermostat(const struct ket *restrict ket)
 {
-  for (uint64_t i = 0; i < N_PARTICLES_TOTAL; i++)
-    {
-      km[i].px += km[i].px * GAMMA * (ket->temperature / T_0 - 1);
-      km[i].py += km[i].py * GAMMA * (ket->temperature / T_0 - 1);
-      km[i].pz += km[i].pz * GAMMA * (ket->temperature / T_0 - 1);
-    }
+  // The temperature is already summed over the subdomains
+  return GAMMA * (ket->temperature / T_0 - 1);
 }
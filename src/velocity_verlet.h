@@ -10,19 +10,35 @@ void compute_kinetic_energy_and_temperature(struct ket *restrict ket,
                                             *restrict km);
 void free_ket(struct ket *restrict ket);
 
-//
+// Kinetic moments, not initialized
+struct kinetic_moment *init_kinetic_moment(void);
+
+// Kinetic moments drawn at random for the temperature T_0, from stream 0 of
+// SEED, set from the time when not set. The same for any number of threads
 struct kinetic_moment *init_velocity_verlet(void);
+
+// Kinetic moments of a replica, drawn from its own stream of SEED
+struct kinetic_moment *init_replica_velocity_verlet(const uint64_t replica);
 void free_kinetic_moment(struct kinetic_moment *restrict km);
 
-//
+// Forces on the particles, with the engine plj was initialized for
+void compute_forces(struct particle *restrict p,
+                    struct translation_vector *restrict tv,
+                    struct lennard_jones *restrict plj,
+                    const double r_cut);
+
+// One step, starting from the forces of the previous step or of
+// compute_forces before the first step. Kinetic moments are first scaled by
+// 1 + thermostat, kinetic energy and temperature of the step are set in ket
 void velocity_verlet(struct particle *restrict p,
                      struct translation_vector *restrict tv,
                      struct lennard_jones *restrict plj,
                      struct kinetic_moment *restrict km,
-                     const double r_cut);
+                     struct ket *restrict ket,
+                     const double r_cut, const double thermostat);
 
-//
-void berendsen_thermostat(struct kinetic_moment *restrict km,
-                          struct ket *restrict ket);
+// Scaling of the kinetic moments, minus 1, bringing the temperature of ket
+// closer to T_0. Applied by the next step
+double berendsen_thermostat(const struct ket *restrict ket);
 
 #endif // _VELOCITY_VERLET_H_
@@ -0,0 +1,471 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <omp.h>
+
+#include "helper.h"
+#include "common.h"
+#include "lennard_jones.h"
+#include "force_engine.h"
+#include "pair_kernel.h"
+#include "velocity_verlet.h"
+#include "rng.h"
+#include "io.h"
+#include "arguments.h"
+
+#if MPI
+#error "The benchmark runs on a single process, build it without MPI"
+#endif
+
+// Floating point operations of one pair inside the cut-off in the pair
+// kernels, a division counted as one
+#define FLOP_PER_PAIR 30
+
+// Global variable
+double L = 50.0;
+uint64_t N_PARTICLES_TOTAL = 0;
+uint64_t N_PARTICLES_LOCAL = 0;
+uint64_t LOCAL_EQUAL_TOTAL = 1;
+uint64_t N_DL = 0;
+uint64_t RANK = 0;
+uint64_t SEED = 1;
+uint64_t PRECISION = PRECISION_DOUBLE;
+
+// Benchmark parameters
+char SIZES[256] = "1000,8000";
+double DENSITY = 0.008;
+uint64_t LATTICE = 0;
+uint64_t WARMUP = 2;
+uint64_t REPETITIONS = 10;
+uint64_t N_STEP = 10;
+uint64_t CSV = 0;
+double R_CUT = 10.0;
+double SKIN = 2.0;
+const struct force_engine *FORCE_ENGINE = NULL;
+
+// State shared by the timed functions
+struct bench
+{
+  struct particle *restrict p;
+  struct lennard_jones *restrict lj;
+  struct lennard_jones *restrict plj;
+  struct lennard_jones *restrict vlj;
+  struct translation_vector *restrict tv;
+  uint64_t n_tv;
+  struct kinetic_moment *restrict km;
+  struct ket *restrict ket;
+  struct trajectory *restrict traj;
+  uint64_t n_reports;
+};
+
+typedef void (*bench_function)(struct bench *restrict b);
+
+int print_usage(const char *const software)
+{
+  printf("[Usage] %s [Options]\n", software);
+  return EXIT_SUCCESS;
+}
+
+int default_action(const char *const arg)
+{
+  printf("Unrecognized argument: %s\n", arg);
+  exit(ERR_USAGE);
+}
+
+int select_sizes(const char *const arg)
+{
+  //
+  const char *ptr = strchr(arg, '=');
+  const char *value = ++ptr;
+  strcpy(SIZES, value);
+  return EXIT_SUCCESS;
+}
+
+int select_density(const char *const arg)
+{
+  //
+  const char *ptr = strchr(arg, '=');
+  const double value = atof(++ptr);
+  DENSITY = value;
+  return EXIT_SUCCESS;
+}
+
+int select_system(const char *const arg)
+{
+  //
+  const char *ptr = strchr(arg, '=');
+  const char *value = ++ptr;
+  LATTICE = strcmp(value, "lattice") == 0;
+  return EXIT_SUCCESS;
+}
+
+int select_warmup(const char *const arg)
+{
+  //
+  const char *ptr = strchr(arg, '=');
+  const uint64_t value = atoll(++ptr);
+  WARMUP = value;
+  return EXIT_SUCCESS;
+}
+
+int select_repetitions(const char *const arg)
+{
+  //
+  const char *ptr = strchr(arg, '=');
+  const uint64_t value = atoll(++ptr);
+  REPETITIONS = value ? value : 1;
+  return EXIT_SUCCESS;
+}
+
+int select_n_step(const char *const arg)
+{
+  //
+  const char *ptr = strchr(arg, '=');
+  const uint64_t value = atoll(++ptr);
+  N_STEP = value ? value : 1;
+  return EXIT_SUCCESS;
+}
+
+int select_format(const char *const arg)
+{
+  //
+  const char *ptr = strchr(arg, '=');
+  const char *value = ++ptr;
+  CSV = strcmp(value, "csv") == 0;
+  return EXIT_SUCCESS;
+}
+
+int select_engine(const char *const arg)
+{
+  //
+  const char *ptr = strchr(arg, '=');
+  const char *value = ++ptr;
+
+  FORCE_ENGINE = find_force_engine(value);
+
+  if (!FORCE_ENGINE)
+    {
+      printf("Unrecognized engine: %s, use one of ", value);
+      print_force_engines();
+      exit(ERR_USAGE);
+    }
+
+  return EXIT_SUCCESS;
+}
+
+int select_precision(const char *const arg)
+{
+  //
+  const char *ptr = strchr(arg, '=');
+  const char *value = ++ptr;
+  PRECISION = strcmp(value, "mixed") == 0 ? PRECISION_MIXED : PRECISION_DOUBLE;
+  return EXIT_SUCCESS;
+}
+
+int select_r_cut(const char *const arg)
+{
+  //
+  const char *ptr = strchr(arg, '=');
+  const double value = atof(++ptr);
+  R_CUT = value;
+  return EXIT_SUCCESS;
+}
+
+int select_skin(const char *const arg)
+{
+  //
+  const char *ptr = strchr(arg, '=');
+  const double value = atof(++ptr);
+  SKIN = value;
+  return EXIT_SUCCESS;
+}
+
+int select_seed(const char *const arg)
+{
+  //
+  const char *ptr = strchr(arg, '=');
+  const uint64_t value = atoll(++ptr);
+  SEED = value ? value : 1;
+  return EXIT_SUCCESS;
+}
+
+int select_n_threads(const char *const arg)
+{
+  //
+  const char *ptr = strchr(arg, '=');
+  const uint64_t value = atoll(++ptr);
+
+  if (value)
+    omp_set_num_threads(value);
+
+  return EXIT_SUCCESS;
+}
+
+//
+static void handle_argument(const int argc, const char **argv)
+{
+  //
+  initArguments(print_usage, default_action);
+
+  //
+  addArgument("--sizes=", NULL, select_sizes, "Select numbers of particles, comma separated.");
+  addArgument("--density=", NULL, select_density, "Select particles per cubic angstrom.");
+  addArgument("--system=", NULL, select_system, "Select random or lattice system.");
+  addArgument("--warmup=", NULL, select_warmup, "Select untimed repetitions.");
+  addArgument("--reps=", NULL, select_repetitions, "Select timed repetitions.");
+  addArgument("--nstep=", NULL, select_n_step, "Select velocity verlet steps per repetition.");
+  addArgument("--format=", NULL, select_format, "Select output format, json or csv.");
+  addArgument("--engine=", NULL, select_engine, "Select force engine of velocity verlet, periodic or all-pairs.");
+  addArgument("--precision=", NULL, select_precision, "Select pair kernels precision, double or mixed.");
+  addArgument("--rcut=", NULL, select_r_cut, "Select R_CUT value.");
+  addArgument("--skin=", NULL, select_skin, "Select neighbour list skin, 0 to disable it.");
+  addArgument("--seed=", NULL, select_seed, "Select the seed of the system and of the kinetic moments.");
+  addArgument("--threads=", "-t=", select_n_threads, "Select the number of threads.");
+
+  //
+  parseArguments(argc, argv);
+}
+
+// Particles on a simple cubic lattice filling a box of density DENSITY,
+// shifted at random by up to a quarter of the lattice spacing unless LATTICE
+static struct particle *generate_particles(const uint64_t n)
+{
+  N_PARTICLES_TOTAL = n;
+  N_PARTICLES_LOCAL = n;
+
+  L = cbrt((double)n / DENSITY);
+
+  const uint64_t m = (uint64_t)ceil(cbrt((double)n));
+  const double spacing = L / (double)m;
+  const double jitter = LATTICE ? 0.0 : 0.5 * spacing;
+
+  struct particle *restrict p = init_particles(n);
+
+  // Not the stream of the kinetic moments
+  const uint64_t key = rng_key(SEED, UINT64_MAX - 1);
+
+#pragma omp parallel for schedule(static)
+  for (uint64_t i = 0; i < n; i++)
+    {
+      p->x[i] = ((double)(i / (m * m)) + 0.5) * spacing;
+      p->y[i] = ((double)((i / m) % m) + 0.5) * spacing;
+      p->z[i] = ((double)(i % m) + 0.5) * spacing;
+
+      p->x[i] += jitter * (rng_uniform(key, 3 * i + 0) - 0.5);
+      p->y[i] += jitter * (rng_uniform(key, 3 * i + 1) - 0.5);
+      p->z[i] += jitter * (rng_uniform(key, 3 * i + 2) - 0.5);
+    }
+
+  return p;
+}
+
+//
+static double now(void)
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+
+  return t.tv_sec + t.tv_nsec * 1.0e-9;
+}
+
+//
+static int compare_double(const void *a, const void *b)
+{
+  const double x = *(const double *)a;
+  const double y = *(const double *)b;
+
+  return (x > y) - (x < y);
+}
+
+// Median time of REPETITIONS calls of f, after WARMUP calls
+static double time_function(bench_function f, struct bench *restrict b)
+{
+  double *restrict t = malloc(sizeof(double) * REPETITIONS);
+
+  for (uint64_t r = 0; r < WARMUP; r++)
+    f(b);
+
+  for (uint64_t r = 0; r < REPETITIONS; r++)
+    {
+      const double before = now();
+      f(b);
+      t[r] = now() - before;
+    }
+
+  qsort(t, REPETITIONS, sizeof(double), compare_double);
+
+  const double median = t[REPETITIONS / 2];
+
+  free(t);
+
+  return median;
+}
+
+//
+static void bench_lennard_jones(struct bench *restrict b)
+{
+  lennard_jones(b->lj, b->p);
+}
+
+//
+static void bench_periodical_lennard_jones(struct bench *restrict b)
+{
+  periodical_lennard_jones(b->plj, b->p, b->tv, R_CUT, b->n_tv);
+}
+
+//
+static void bench_velocity_verlet(struct bench *restrict b)
+{
+  for (uint64_t step = 0; step < N_STEP; step++)
+    velocity_verlet(b->p, b->tv, b->vlj, b->km, b->ket, R_CUT, 0.0);
+}
+
+// Kinetic moments of every particle
+static void bench_init_velocity_verlet(__attribute__ ((unused)) struct bench *restrict b)
+{
+  free_kinetic_moment(init_velocity_verlet());
+}
+
+// One frame, until it is on disk
+static void bench_store_particles(struct bench *restrict b)
+{
+  store_particles(b->traj, b->p, NULL, 0);
+  flush_trajectory(b->traj);
+}
+
+// Pairs of a uniform system closer than R_CUT
+static double pairs_in_cut_off(const uint64_t n)
+{
+  const double pairs =
+    0.5 * (double)n * DENSITY * 4.0 / 3.0 * M_PI * cube(R_CUT);
+  const double all = 0.5 * (double)n * (double)(n - 1);
+
+  return pairs < all ? pairs : all;
+}
+
+//
+static void report(struct bench *restrict b, const char *kernel,
+                   const uint64_t n, const double seconds,
+                   const uint64_t n_step, const double pairs)
+{
+  const double ns_per_atom_step = seconds * 1.0e9 / ((double)n * n_step);
+  const double pairs_per_second = pairs * n_step / seconds;
+  const double gflops = pairs_per_second * FLOP_PER_PAIR * 1.0e-9;
+
+  if (CSV)
+    {
+      if (b->n_reports == 0)
+        printf("kernel,system,n,density,box,threads,seconds,"
+               "ns_per_atom_step,pairs_per_second,gflops\n");
+
+      printf("%s,%s,%ld,%lf,%lf,%d,%e,%e,%e,%e\n",
+             kernel, LATTICE ? "lattice" : "random", n, DENSITY, L,
+             omp_get_max_threads(), seconds, ns_per_atom_step,
+             pairs_per_second, gflops);
+    }
+  else
+    printf("%s  {\"kernel\": \"%s\", \"system\": \"%s\", \"n\": %ld, "
+           "\"density\": %lf, \"box\": %lf, \"threads\": %d, "
+           "\"seconds\": %e, \"ns_per_atom_step\": %e, "
+           "\"pairs_per_second\": %e, \"gflops\": %e}",
+           b->n_reports ? ",\n" : "",
+           kernel, LATTICE ? "lattice" : "random", n, DENSITY, L,
+           omp_get_max_threads(), seconds, ns_per_atom_step,
+           pairs_per_second, gflops);
+
+  b->n_reports++;
+}
+
+//
+static void run_bench(struct bench *restrict b, const uint64_t n)
+{
+  // System
+  b->p = generate_particles(n);
+  b->n_tv = n_translation_vectors(R_CUT);
+  b->tv = init_translation_vectors(b->n_tv);
+
+  const double all_pairs = 0.5 * (double)n * (double)(n - 1);
+  const double cut_pairs = pairs_in_cut_off(n);
+
+  // Lennard jones
+  b->lj = init_lennard_jones();
+  report(b, "lennard_jones", n,
+         time_function(bench_lennard_jones, b), 1, all_pairs);
+  free_lennard_jones(b->lj);
+
+  // Periodical lennard jones, as run by main
+  b->plj = init_periodical_lennard_jones(R_CUT, 0.0);
+  report(b, "periodical_lennard_jones", n,
+         time_function(bench_periodical_lennard_jones, b), 1, cut_pairs);
+  free_lennard_jones(b->plj);
+
+  // Kinetic moments
+  report(b, "init_velocity_verlet", n,
+         time_function(bench_init_velocity_verlet, b), 1, 0.0);
+
+  // Velocity verlet, with the selected force engine
+  b->vlj = init_force_engine(FORCE_ENGINE, R_CUT, SKIN);
+  b->km = init_velocity_verlet();
+  b->ket = init_ket();
+  compute_forces(b->p, b->tv, b->vlj, R_CUT);
+
+  const double vv_pairs = FORCE_ENGINE->periodic ? cut_pairs : all_pairs;
+
+  report(b, "velocity_verlet", n,
+         time_function(bench_velocity_verlet, b), N_STEP, vv_pairs);
+
+  free_ket(b->ket);
+  free_kinetic_moment(b->km);
+  FORCE_ENGINE->free(b->vlj);
+
+  // Trajectory frames, in both formats
+  const char *filename = "bench.traj";
+
+  b->traj = open_trajectory(filename, FORMAT_PDB, 0.0, 0);
+  report(b, "store_particles_pdb", n,
+         time_function(bench_store_particles, b), 1, 0.0);
+  close_trajectory(b->traj);
+
+  b->traj = open_trajectory(filename, FORMAT_BIN, 0.0, 0);
+  report(b, "store_particles_bin", n,
+         time_function(bench_store_particles, b), 1, 0.0);
+  close_trajectory(b->traj);
+
+  b->traj = open_trajectory(filename, FORMAT_COMPRESSED, 0.001, 0);
+  report(b, "store_particles_compressed", n,
+         time_function(bench_store_particles, b), 1, 0.0);
+  close_trajectory(b->traj);
+
+  unlink(filename);
+
+  // Release memory
+  free_translation_vector(b->tv);
+  free_particles(b->p);
+}
+
+int main(int argc, char **argv)
+{
+  // Handle command line argument
+  handle_argument(argc, (const char **)argv);
+
+  if (!FORCE_ENGINE)
+    FORCE_ENGINE = find_force_engine("periodic");
+
+  //
+  struct bench b = { .n_reports = 0 };
+
+  if (!CSV)
+    printf("[\n");
+
+  for (char *size = strtok(SIZES, ","); size; size = strtok(NULL, ","))
+    run_bench(&b, atoll(size));
+
+  if (!CSV)
+    printf("\n]\n");
+
+  return 0;
+}
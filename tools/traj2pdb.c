@@ -0,0 +1,54 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "helper.h"
+#include "io.h"
+
+// Global variable
+double L = 50.0;
+uint64_t N_PARTICLES_TOTAL = 0;
+
+// Convert a binary or compressed trajectory to PDB, for visualization
+int main(int argc, char **argv)
+{
+  // Check argument
+  if (argc != 3)
+    {
+      printf("[Usage] %s input output.pdb\n", argv[0]);
+      exit(ERR_USAGE);
+    }
+
+  //
+  struct trajectory *restrict in = read_trajectory(argv[1]);
+  struct trajectory *restrict out = open_trajectory(argv[2], FORMAT_PDB, 0.0, 0);
+
+  // Positions of a frame
+  struct particle p;
+
+  p.x = aligned_alloc(ALIGN, sizeof(double) * N_PARTICLES_TOTAL);
+  p.y = aligned_alloc(ALIGN, sizeof(double) * N_PARTICLES_TOTAL);
+  p.z = aligned_alloc(ALIGN, sizeof(double) * N_PARTICLES_TOTAL);
+
+  //
+  uint64_t ite = 0;
+  uint64_t n_frames = 0;
+
+  while (load_particles(in, &p, &ite))
+    {
+      store_particles(out, &p, NULL, ite);
+      n_frames++;
+    }
+
+  printf("Converted %ld frames of %ld particles\n", n_frames, N_PARTICLES_TOTAL);
+
+  // Release memory
+  free(p.x);
+  free(p.y);
+  free(p.z);
+
+  close_trajectory(in);
+  close_trajectory(out);
+
+  return 0;
+}